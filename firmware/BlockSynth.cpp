@@ -0,0 +1,223 @@
+/* Copyright (C) 2017  Adam Green (https://github.com/adamgreen)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <string.h>
+#include <mbed.h>
+#include "BlockSynth.h"
+#include "DmaDac.h"
+
+
+// Number of times the block is synthesized when measuring the cycle count. The minimum is used to filter out any
+// interrupts which happen to land in the middle of a run.
+#define BENCHMARK_RUNS 8
+
+
+int16_t BlockSynth::s_sineTable[SINE_TABLE_LENGTH];
+bool    BlockSynth::s_isSineTableGenerated = false;
+
+
+BlockSynth::BlockSynth()
+{
+    generateSineTable();
+    m_noiseState = 2463534242;
+    m_bias = 32768;
+    reset();
+}
+
+void BlockSynth::generateSineTable()
+{
+    if (s_isSineTableGenerated)
+        return;
+
+    for (size_t i = 0 ; i < SINE_TABLE_LENGTH ; i++)
+    {
+        s_sineTable[i] = (int16_t)(32767.0f * sinf((float)i * (2.0f * M_PI / SINE_TABLE_LENGTH)));
+    }
+    s_isSineTableGenerated = true;
+}
+
+void BlockSynth::reset()
+{
+    memset(m_tones, 0, sizeof(m_tones));
+    memset(m_pinkState, 0, sizeof(m_pinkState));
+    m_noiseType = NOISE_NONE;
+    m_noiseGain = 0;
+}
+
+void BlockSynth::setTone(uint32_t index, uint32_t phaseIncrement, int32_t gain)
+{
+    if (index >= MAX_TONES)
+        return;
+    m_tones[index].increment = phaseIncrement;
+    m_tones[index].gain = gain;
+}
+
+void BlockSynth::setNoise(NoiseType type, int32_t gain)
+{
+    m_noiseType = type;
+    m_noiseGain = gain;
+}
+
+void BlockSynth::fill(uint32_t* pBlock, size_t blockLength)
+{
+    while (blockLength > 0)
+    {
+        size_t length = blockLength;
+        if (length > MAX_BLOCK_LENGTH)
+            length = MAX_BLOCK_LENGTH;
+        mixBlock(pBlock, length);
+        pBlock += length;
+        blockLength -= length;
+    }
+}
+
+void BlockSynth::mixBlock(uint32_t* pBlock, size_t blockLength)
+{
+    memset(m_mix, 0, blockLength * sizeof(m_mix[0]));
+    for (size_t i = 0 ; i < MAX_TONES ; i++)
+    {
+        if (m_tones[i].increment != 0)
+            mixTone(&m_tones[i], blockLength);
+    }
+    switch (m_noiseType)
+    {
+    case NOISE_WHITE:
+        mixWhiteNoise(blockLength);
+        break;
+    case NOISE_PINK:
+        mixPinkNoise(blockLength);
+        break;
+    default:
+        break;
+    }
+    saturateToDac(pBlock, blockLength);
+}
+
+void BlockSynth::mixTone(Oscillator* pTone, size_t blockLength)
+{
+    static const uint32_t shift = 32 - SINE_TABLE_BITS;
+    const int16_t*        pSine = s_sineTable;
+    int32_t*              pMix = m_mix;
+    uint32_t              phase = pTone->phase;
+    uint32_t              increment = pTone->increment;
+    int32_t               gain = pTone->gain;
+
+    // Unrolled 4 times so that the loop overhead is shared and the compiler can schedule the table loads back to back.
+    for (size_t i = blockLength >> 2 ; i > 0 ; i--)
+    {
+        int32_t sample0 = pSine[phase >> shift];
+        phase += increment;
+        int32_t sample1 = pSine[phase >> shift];
+        phase += increment;
+        int32_t sample2 = pSine[phase >> shift];
+        phase += increment;
+        int32_t sample3 = pSine[phase >> shift];
+        phase += increment;
+
+        pMix[0] += (sample0 * gain) >> 15;
+        pMix[1] += (sample1 * gain) >> 15;
+        pMix[2] += (sample2 * gain) >> 15;
+        pMix[3] += (sample3 * gain) >> 15;
+        pMix += 4;
+    }
+    for (size_t i = blockLength & 3 ; i > 0 ; i--)
+    {
+        *pMix++ += (pSine[phase >> shift] * gain) >> 15;
+        phase += increment;
+    }
+
+    pTone->phase = phase;
+}
+
+void BlockSynth::mixWhiteNoise(size_t blockLength)
+{
+    int32_t* pMix = m_mix;
+    int32_t  gain = m_noiseGain;
+
+    for (size_t i = blockLength >> 2 ; i > 0 ; i--)
+    {
+        pMix[0] += (nextWhiteSample() * gain) >> 15;
+        pMix[1] += (nextWhiteSample() * gain) >> 15;
+        pMix[2] += (nextWhiteSample() * gain) >> 15;
+        pMix[3] += (nextWhiteSample() * gain) >> 15;
+        pMix += 4;
+    }
+    for (size_t i = blockLength & 3 ; i > 0 ; i--)
+    {
+        *pMix++ += (nextWhiteSample() * gain) >> 15;
+    }
+}
+
+void BlockSynth::mixPinkNoise(size_t blockLength)
+{
+    int32_t* pMix = m_mix;
+    int32_t  gain = m_noiseGain;
+    int32_t  b0 = m_pinkState[0];
+    int32_t  b1 = m_pinkState[1];
+    int32_t  b2 = m_pinkState[2];
+
+    // Paul Kellet's economy pink noise filter: three one pole low pass filters at staggered corner frequencies. Poles
+    // are Q16 and input weights are Q15. The sum has about 3 times the RMS of the white input so it is scaled down by 8
+    // to keep clipping rare.
+    for (size_t i = 0 ; i < blockLength ; i++)
+    {
+        int32_t white = nextWhiteSample();
+        b0 = (int32_t)(((int64_t)b0 * 65382) >> 16) + ((white * 3246) >> 15);
+        b1 = (int32_t)(((int64_t)b1 * 63111) >> 16) + ((white * 9716) >> 15);
+        b2 = (int32_t)(((int64_t)b2 * 37356) >> 16) + ((white * 34494) >> 15);
+        int32_t pink = (b0 + b1 + b2 + ((white * 6056) >> 15)) >> 3;
+        *pMix++ += (pink * gain) >> 15;
+    }
+
+    m_pinkState[0] = b0;
+    m_pinkState[1] = b1;
+    m_pinkState[2] = b2;
+}
+
+void BlockSynth::saturateToDac(uint32_t* pBlock, size_t blockLength)
+{
+    const int32_t* pMix = m_mix;
+    int32_t        bias = m_bias;
+
+    for (size_t i = blockLength >> 2 ; i > 0 ; i--)
+    {
+        pBlock[0] = __USAT(bias + pMix[0], 16) & DmaDac::DAC_VALUE_MASK;
+        pBlock[1] = __USAT(bias + pMix[1], 16) & DmaDac::DAC_VALUE_MASK;
+        pBlock[2] = __USAT(bias + pMix[2], 16) & DmaDac::DAC_VALUE_MASK;
+        pBlock[3] = __USAT(bias + pMix[3], 16) & DmaDac::DAC_VALUE_MASK;
+        pBlock += 4;
+        pMix += 4;
+    }
+    for (size_t i = blockLength & 3 ; i > 0 ; i--)
+    {
+        *pBlock++ = __USAT(bias + *pMix++, 16) & DmaDac::DAC_VALUE_MASK;
+    }
+}
+
+uint32_t BlockSynth::measureFillCycles(uint32_t* pBlock, size_t blockLength)
+{
+    uint32_t minCycles = ~0U;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    for (int i = 0 ; i < BENCHMARK_RUNS ; i++)
+    {
+        uint32_t startCycles = DWT->CYCCNT;
+        fill(pBlock, blockLength);
+        uint32_t elapsedCycles = DWT->CYCCNT - startCycles;
+        if (elapsedCycles < minCycles)
+            minCycles = elapsedCycles;
+    }
+    return minCycles;
+}
@@ -0,0 +1,92 @@
+/* Copyright (C) 2017  Adam Green (https://github.com/adamgreen)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef BLOCK_SYNTH_H_
+#define BLOCK_SYNTH_H_
+
+#include <mbed.h>
+
+
+// Synthesizes blocks of DAC values by mixing several phase accumulator sine oscillators and a noise source. All of the
+// mixing is done in fixed point, one source at a time across the whole block, and then saturated to the DAC's 10-bit
+// range on the way out.
+class BlockSynth
+{
+public:
+    enum { MAX_TONES = 4, MAX_BLOCK_LENGTH = 64 };
+    enum NoiseType
+    {
+        NOISE_NONE = 0,
+        NOISE_WHITE,
+        NOISE_PINK
+    };
+
+    BlockSynth();
+
+    // Gains are Q15 fractions of full scale (32768 == 100%). A phase increment of 0 disables the tone.
+    void setTone(uint32_t index, uint32_t phaseIncrement, int32_t gain);
+    void setNoise(NoiseType type, int32_t gain);
+    // DAC value which the mix is centred on before saturation. Defaults to mid scale.
+    void setBias(int32_t bias)
+    {
+        m_bias = bias;
+    }
+    void reset();
+
+    void fill(uint32_t* pBlock, size_t blockLength);
+
+    // Minimum number of CPU cycles taken by fill() over several runs.
+    uint32_t measureFillCycles(uint32_t* pBlock, size_t blockLength);
+
+protected:
+    enum { SINE_TABLE_BITS = 10, SINE_TABLE_LENGTH = 1 << SINE_TABLE_BITS };
+
+    struct Oscillator
+    {
+        uint32_t phase;
+        uint32_t increment;
+        int32_t  gain;
+    };
+
+    void mixBlock(uint32_t* pBlock, size_t blockLength);
+    void mixTone(Oscillator* pTone, size_t blockLength);
+    void mixWhiteNoise(size_t blockLength);
+    void mixPinkNoise(size_t blockLength);
+    void saturateToDac(uint32_t* pBlock, size_t blockLength);
+    int32_t nextWhiteSample()
+    {
+        // xorshift32 is an LFSR which advances all 32 bits of state per sample.
+        uint32_t state = m_noiseState;
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        m_noiseState = state;
+        return (int32_t)state >> 16;
+    }
+
+    static void generateSineTable();
+
+    static int16_t    s_sineTable[SINE_TABLE_LENGTH];
+    static bool       s_isSineTableGenerated;
+
+    Oscillator        m_tones[MAX_TONES];
+    int32_t           m_mix[MAX_BLOCK_LENGTH];
+    int32_t           m_pinkState[3];
+    uint32_t          m_noiseState;
+    int32_t           m_noiseGain;
+    int32_t           m_bias;
+    NoiseType         m_noiseType;
+};
+
+#endif // BLOCK_SYNTH_H_
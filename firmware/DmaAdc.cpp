@@ -0,0 +1,160 @@
+/* Copyright (C) 2017  Adam Green (https://github.com/adamgreen)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <mbed.h>
+#include "DmaAdc.h"
+
+
+// This class utilizes DMA based ADC hardware. It was only coded to work on the LPC1768.
+#ifndef TARGET_LPC176X
+    #error("This DmaAdc class was only coded to work on the LPC1768.")
+#endif
+
+
+// The ADC clock can't exceed 13MHz and each conversion takes 65 ADC clocks in burst mode.
+#define ADC_CLOCK_MAX               13000000
+#define ADC_CLOCKS_PER_CONVERSION   65
+
+// ADCR bits.
+#define ADCR_CLKDIV_SHIFT           8
+#define ADCR_BURST                  (1 << 16)
+#define ADCR_PDN                    (1 << 21)
+
+// ADDRx bits.
+#define ADDR_RESULT_SHIFT           4
+#define ADDR_RESULT_MASK            0xFFF
+
+#define PCLKSEL0_ADC_SHIFT          24
+
+
+DmaAdc::DmaAdc(PinName pin) : AnalogIn(pin)
+{
+    // Setup GPDMA module.
+    enableGpdmaPower();
+    enableGpdmaInLittleEndianMode();
+
+    // Allocate DMA channel for receiving.
+    m_channelRx = allocateDmaChannel(GPDMA_CHANNEL_LOW);
+    m_pChannelRx = dmaChannelFromIndex(m_channelRx);
+
+    // Run the ADC as fast as its 13MHz clock limit allows.
+    uint32_t adcClock = adcPeripheralClock();
+    m_adcChannel = adcChannelFromPin(pin);
+    m_clockDivider = (adcClock + ADC_CLOCK_MAX - 1) / ADC_CLOCK_MAX;
+    m_sampleRate = adcClock / m_clockDivider / ADC_CLOCKS_PER_CONVERSION;
+}
+
+DmaAdc::~DmaAdc()
+{
+    stopBurst();
+    freeDmaChannel(m_channelRx);
+}
+
+int DmaAdc::adcChannelFromPin(PinName pin)
+{
+    switch (pin)
+    {
+    case p15:
+        return 0;
+    case p16:
+        return 1;
+    case p17:
+        return 2;
+    case p19:
+        return 4;
+    case p20:
+        return 5;
+    default:
+        error("DmaAdc: Pin isn't an ADC input.\r\n");
+        return -1;
+    }
+}
+
+uint32_t DmaAdc::adcPeripheralClock()
+{
+    static const uint8_t dividers[] = { 4, 1, 2, 8 };
+    return SystemCoreClock / dividers[(LPC_SC->PCLKSEL0 >> PCLKSEL0_ADC_SHIFT) & 3];
+}
+
+bool DmaAdc::capture(uint32_t* pSamples, size_t sampleLength)
+{
+    volatile uint32_t* pResult = &LPC_ADC->ADDR0 + m_adcChannel;
+    uint32_t           channelMask = 1 << m_channelRx;
+    uint32_t           timeoutMs = (sampleLength * 2000) / m_sampleRate + 10;
+    Timer              timer;
+
+    stopBurst();
+    LPC_GPDMA->DMACIntTCClear = channelMask;
+    LPC_GPDMA->DMACIntErrClr = channelMask;
+
+    m_pChannelRx->DMACCSrcAddr  = (uint32_t)pResult;
+    m_pChannelRx->DMACCDestAddr = (uint32_t)pSamples;
+    m_pChannelRx->DMACCLLI      = 0;
+    // The I bit is needed for the terminal count to show up in DMACRawIntTCStat. DMACCxCONFIG_ITC stays clear below so
+    // it is only polled and never raises the shared DMA interrupt.
+    m_pChannelRx->DMACCControl  = DMACCxCONTROL_I | DMACCxCONTROL_DI |
+                     (DMACCxCONTROL_BURSTSIZE_1 << DMACCxCONTROL_SBSIZE_SHIFT) |
+                     (DMACCxCONTROL_BURSTSIZE_1 << DMACCxCONTROL_DBSIZE_SHIFT) |
+                     (DMACCxCONTROL_WIDTH_WORD << DMACCxCONTROL_SWIDTH_SHIFT) |
+                     (DMACCxCONTROL_WIDTH_WORD << DMACCxCONTROL_DWIDTH_SHIFT) |
+                     (sampleLength & DMACCxCONTROL_TRANSFER_SIZE_MASK);
+
+    // Enable receive channel.
+    m_pChannelRx->DMACCConfig = DMACCxCONFIG_ENABLE |
+                   (DMA_PERIPHERAL_ADC << DMACCxCONFIG_SRC_PERIPHERAL_SHIFT) |
+                   DMACCxCONFIG_TRANSFER_TYPE_P2M;
+
+    startBurst();
+    timer.start();
+    while ((LPC_GPDMA->DMACRawIntTCStat & channelMask) == 0)
+    {
+        if ((uint32_t)timer.read_ms() > timeoutMs || (LPC_GPDMA->DMACRawIntErrStat & channelMask))
+        {
+            stopBurst();
+            m_pChannelRx->DMACCConfig &= ~DMACCxCONFIG_ENABLE;
+            return false;
+        }
+    }
+    stopBurst();
+    LPC_GPDMA->DMACIntTCClear = channelMask;
+
+    convertAdcValuesToSamples(pSamples, sampleLength);
+    return true;
+}
+
+void DmaAdc::startBurst()
+{
+    // The DONE flag of the selected channel raises the ADC's DMA request when its interrupt is enabled.
+    LPC_ADC->ADINTEN = 1 << m_adcChannel;
+    LPC_ADC->ADCR = (1 << m_adcChannel) |
+                    ((m_clockDivider - 1) << ADCR_CLKDIV_SHIFT) |
+                    ADCR_BURST |
+                    ADCR_PDN;
+}
+
+void DmaAdc::stopBurst()
+{
+    LPC_ADC->ADCR &= ~ADCR_BURST;
+    LPC_ADC->ADINTEN = 0;
+}
+
+void DmaAdc::convertAdcValuesToSamples(uint32_t* pSamples, size_t sampleLength)
+{
+    for (size_t i = 0 ; i < sampleLength ; i++)
+    {
+        // Scale the 12-bit result up to 16-bits.
+        uint32_t result = (pSamples[i] >> ADDR_RESULT_SHIFT) & ADDR_RESULT_MASK;
+        pSamples[i] = (result << 4) | (result >> 8);
+    }
+}
@@ -0,0 +1,54 @@
+/* Copyright (C) 2017  Adam Green (https://github.com/adamgreen)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef DMA_ADC_H_
+#define DMA_ADC_H_
+
+#include <mbed.h>
+#include "GPDMA.h"
+
+
+// Captures blocks of samples from a single ADC channel, running the ADC in burst mode with a GPDMA channel moving each
+// result into memory.
+class DmaAdc : public AnalogIn
+{
+public:
+    DmaAdc(PinName pin);
+    ~DmaAdc();
+
+    // Blocks until sampleLength samples (up to 4095) have been captured into pSamples, which should be in AHB SRAM
+    // (ie. dmaHeap1Alloc()). Samples are converted to 16-bit values to match the DAC's scale. Returns false if the
+    // capture didn't complete.
+    bool     capture(uint32_t* pSamples, size_t sampleLength);
+    uint32_t getSampleRate()
+    {
+        return m_sampleRate;
+    }
+
+protected:
+    void     startBurst();
+    void     stopBurst();
+    void     convertAdcValuesToSamples(uint32_t* pSamples, size_t sampleLength);
+
+    static int      adcChannelFromPin(PinName pin);
+    static uint32_t adcPeripheralClock();
+
+    LPC_GPDMACH_TypeDef*        m_pChannelRx;
+    uint32_t                    m_channelRx;
+    uint32_t                    m_adcChannel;
+    uint32_t                    m_clockDivider;
+    uint32_t                    m_sampleRate;
+};
+
+#endif // DMA_ADC_H_
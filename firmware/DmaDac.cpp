@@ -15,6 +15,7 @@
 #include <assert.h>
 #include <mbed.h>
 #include "DmaDac.h"
+#include "Telemetry.h"
 
 
 // This class utilizes DMA based DAC hardware. It was only coded to work on the LPC1768.
@@ -23,6 +24,26 @@
 #endif
 
 
+// Keep the source pointer at least this many words away from the end of the samples when updating a list item which
+// the DMA channel is looping over. This covers the 4 word FIFO of the channel, which reads ahead of the DAC, plus some
+// slack so that the list item updates can't be split across a reload of that item.
+#define RELINK_GUARD_WORDS 6
+
+// DACCTRL bits.
+#define DACCTRL_CNT_ENA     (1 << 2)
+#define DACCTRL_DMA_ENA     (1 << 3)
+
+// TIMER1 is used for timer match pacing. Its match 0 shares DMA request line 10 with UART1 TX.
+#define PCONP_PCTIM1        (1 << 2)
+#define PCLKSEL0_TIM1_SHIFT 4
+#define PCLKSEL_CCLK        1
+#define DMAREQSEL_MAT1_0    (1 << 2)
+#define TCR_ENABLE          (1 << 0)
+#define TCR_RESET           (1 << 1)
+#define MCR_MR0R            (1 << 1)
+#define IR_MR0              (1 << 0)
+
+
 DmaDac::DmaDac(PinName pin) : AnalogOut(pin)
 {
     // Setup GPDMA module.
@@ -33,7 +54,35 @@ DmaDac::DmaDac(PinName pin) : AnalogOut(pin)
     m_channelTx = allocateDmaChannel(GPDMA_CHANNEL_LOW);
     m_pChannelTx = dmaChannelFromIndex(m_channelTx);
 
+    // Terminal count interrupts are used to update the DAC sample rate when relinking to a new list item.
+    m_interruptHandler.handler = dmaInterruptHandler;
+    m_interruptHandler.pContext = this;
+    m_interruptHandler.pNext = NULL;
+    addDmaInterruptHandler(&m_interruptHandler);
+
+    m_pActiveListItem = NULL;
+    m_pPendingListItem = NULL;
+    m_pRelinkedListItem = NULL;
+    m_pendingDacTicksPerSample = 0;
+    m_pendingDacTicksFraction = 0;
+    m_relinkCycles = 0;
+    m_pStreamBlocks = NULL;
+    m_streamBlockLength = 0;
+    m_nextStreamBlock = 0;
+    m_lastFillCycles = 0;
+    m_maxFillCycles = 0;
+    m_dacTicksPerSample = 0;
+    m_dacTicksFraction = 0;
+    m_ditherAccumulator = 0;
+    m_pacing = PACING_DAC_COUNTER;
     m_isLooping = false;
+    m_isStreaming = false;
+    m_relinkSetInterrupt = false;
+    m_isArmed = false;
+
+    // The cycle counter is used to measure how much of each streamed block is spent refilling it.
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
 
     // Default to a sample frequency of 100kHz (10 microseconds/sample);
     setSampleTime(10);
@@ -42,60 +91,437 @@ DmaDac::DmaDac(PinName pin) : AnalogOut(pin)
 DmaDac::~DmaDac()
 {
     stop();
+    removeDmaInterruptHandler(&m_interruptHandler);
     freeDmaChannel(m_channelTx);
 }
 
 void DmaDac::setSampleTime(uint32_t sampleTimeInNanoSeconds)
+{
+    if (m_pacing == PACING_TIMER_MATCH)
+        setTimerTicksPerSample((uint32_t)(((uint64_t)sampleTimeInNanoSeconds * SystemCoreClock) / 1000000000) - 1);
+    else
+        setDacTicksPerSample(calculateDacTicksPerSample(sampleTimeInNanoSeconds));
+}
+
+uint32_t DmaDac::calculateDacTicksPerSample(uint32_t sampleTimeInNanoSeconds)
 {
     // Note: DAC runs at 1/4 the CPU core clock.
-    uint32_t dacTicksPerSample = (uint32_t)(((uint64_t)sampleTimeInNanoSeconds * (uint64_t)SystemCoreClock) / (uint64_t)4000000000) - 1;
-    LPC_DAC->DACCNTVAL = dacTicksPerSample;
+    return (uint32_t)(((uint64_t)sampleTimeInNanoSeconds * (uint64_t)SystemCoreClock) / (uint64_t)4000000000) - 1;
+}
+
+void DmaDac::setDacTicksPerSample(uint32_t dacTicksPerSample, uint32_t fraction)
+{
+    m_dacTicksPerSample = dacTicksPerSample;
+    m_dacTicksFraction = fraction & 0xFFFF;
+    if (m_pacing == PACING_TIMER_MATCH)
+    {
+        // TIMER1 counts CPU clocks so the fraction is rounded to the nearest quarter of a DAC tick rather than dithered.
+        setTimerMatch(4 * (dacTicksPerSample + 1) + ((m_dacTicksFraction + 0x2000) >> 14) - 1);
+    }
+    else
+    {
+        LPC_DAC->DACCNTVAL = dacTicksPerSample;
+    }
+}
+
+void DmaDac::setTimerMatch(uint32_t timerTicksPerSample)
+{
+    // Unlike DACCNTVAL, MR0 isn't shadowed. A match value below the running count would be missed and leave the timer
+    // running through its whole 32-bit range so cut the current sample short instead.
+    LPC_TIM1->MR0 = timerTicksPerSample;
+    if (LPC_TIM1->TC > timerTicksPerSample)
+        LPC_TIM1->TC = 0;
+}
+
+void DmaDac::ditherDacTicks()
+{
+    // First order error diffusion: the fraction accumulates from block to block and each carry out of it plays one
+    // block with an extra tick per sample. The DAC reloads DACCNTVAL each time its counter runs out so a new value
+    // never cuts a sample short. TIMER1 has no such shadowing so timer pacing gets its finer steps from counting CPU
+    // clocks instead.
+    if (m_dacTicksFraction == 0 || m_pacing != PACING_DAC_COUNTER)
+        return;
+
+    LPC_DAC->DACCNTVAL = ditherTicks(&m_ditherAccumulator, m_dacTicksPerSample, m_dacTicksFraction);
+}
+
+uint32_t DmaDac::ditherTicks(uint32_t* pAccumulator, uint32_t dacTicksPerSample, uint32_t fraction)
+{
+    uint32_t accumulator = *pAccumulator + fraction;
+    *pAccumulator = accumulator & 0xFFFF;
+    return dacTicksPerSample + (accumulator >> 16);
+}
+
+void DmaDac::setTimerTicksPerSample(uint32_t timerTicksPerSample)
+{
+    // Keep the equivalent DAC tick count around in case the pacing source is switched back to the DAC counter.
+    m_dacTicksPerSample = (timerTicksPerSample + 1) / 4 - 1;
+    m_dacTicksFraction = ((timerTicksPerSample + 1) & 3) << 14;
+    if (m_pacing == PACING_TIMER_MATCH)
+        setTimerMatch(timerTicksPerSample);
+    else
+        LPC_DAC->DACCNTVAL = m_dacTicksPerSample;
+}
+
+void DmaDac::setPacing(PacingSource source)
+{
+    stopTransfer();
+
+    m_pacing = source;
+    if (source == PACING_TIMER_MATCH)
+    {
+        // Run TIMER1 from the CPU clock, resetting on each match 0 (sample) and hold it in reset until started.
+        LPC_SC->PCONP |= PCONP_PCTIM1;
+        LPC_SC->PCLKSEL0 = (LPC_SC->PCLKSEL0 & ~(3 << PCLKSEL0_TIM1_SHIFT)) | (PCLKSEL_CCLK << PCLKSEL0_TIM1_SHIFT);
+        LPC_TIM1->TCR = TCR_RESET;
+        LPC_TIM1->PR = 0;
+        LPC_TIM1->MCR = MCR_MR0R;
+        // A match left over from before would otherwise raise a DMA request as soon as the channel is enabled.
+        LPC_TIM1->IR = IR_MR0;
+        LPC_SC->DMAREQSEL |= DMAREQSEL_MAT1_0;
+    }
+    else
+    {
+        LPC_SC->DMAREQSEL &= ~DMAREQSEL_MAT1_0;
+    }
+    setDacTicksPerSample(m_dacTicksPerSample, m_dacTicksFraction);
 }
 
 void DmaDac::start(uint32_t* pSamples, size_t sampleLength, bool loopSamples)
 {
-    stop();
+    stopTransfer();
     convertSamplesToDacValues(pSamples, sampleLength);
+    startConverted(pSamples, sampleLength, loopSamples);
+}
 
-    // Configure DMA channel options required for both looping and non-looping samples.
-    uint32_t srcAddr = (uint32_t)pSamples;
-    uint32_t destAddr = (uint32_t)&LPC_DAC->DACR;
-    uint32_t control  = DMACCxCONTROL_SI |
+void DmaDac::startConverted(uint32_t* pSamples, size_t sampleLength, bool loopSamples)
+{
+    if (loopSamples)
+    {
+        // Prepare transmit channel DMA circular linked list.
+        initLoopingListItem(&m_dmaListItem, pSamples, sampleLength);
+        startLooping(&m_dmaListItem);
+        return;
+    }
+
+    uint32_t startCycles = DWT->CYCCNT;
+    stopTransfer();
+    initLoopingListItem(&m_dmaListItem, pSamples, sampleLength);
+    m_pChannelTx->DMACCSrcAddr  = m_dmaListItem.DMACCxSrcAddr;
+    m_pChannelTx->DMACCDestAddr = m_dmaListItem.DMACCxDestAddr;
+    m_pChannelTx->DMACCControl  = m_dmaListItem.DMACCxControl;
+    m_pChannelTx->DMACCLLI      = 0;
+    enableTransmitChannel();
+    recordStart(startCycles);
+}
+
+void DmaDac::initLoopingListItem(DmaLinkedListItem* pItem, uint32_t* pConvertedSamples, size_t sampleLength)
+{
+    pItem->DMACCxSrcAddr  = (uint32_t)pConvertedSamples;
+    pItem->DMACCxDestAddr = (uint32_t)&LPC_DAC->DACR;
+    pItem->DMACCxLLI      = (uint32_t)pItem;
+    pItem->DMACCxControl  = DMACCxCONTROL_SI |
                      (DMACCxCONTROL_BURSTSIZE_1 << DMACCxCONTROL_SBSIZE_SHIFT) |
                      (DMACCxCONTROL_BURSTSIZE_1 << DMACCxCONTROL_DBSIZE_SHIFT) |
                      (DMACCxCONTROL_WIDTH_WORD << DMACCxCONTROL_SWIDTH_SHIFT) |
                      (DMACCxCONTROL_WIDTH_WORD << DMACCxCONTROL_DWIDTH_SHIFT) |
                      (sampleLength & DMACCxCONTROL_TRANSFER_SIZE_MASK);
+}
 
-    m_pChannelTx->DMACCSrcAddr  = srcAddr;
-    m_pChannelTx->DMACCDestAddr = destAddr;
-    m_pChannelTx->DMACCControl  = control;
-    if (loopSamples)
-    {
-        // Prepare transmit channel DMA circular linked list.
-        m_dmaListItem.DMACCxSrcAddr  = srcAddr;
-        m_dmaListItem.DMACCxDestAddr = destAddr;
-        m_dmaListItem.DMACCxLLI      = (uint32_t)&m_dmaListItem;
-        m_dmaListItem.DMACCxControl  = control;
+void DmaDac::initLoopingListItems(DmaLinkedListItem* pItems, size_t itemCount, uint32_t* pConvertedSamples,
+                                  size_t sampleLength)
+{
+    size_t blockLength = sampleLength / itemCount;
 
-        m_pChannelTx->DMACCLLI      = (uint32_t)&m_dmaListItem;
+    for (size_t i = 0 ; i < itemCount ; i++)
+    {
+        // The last block picks up any samples left over from the division.
+        size_t length = (i == itemCount - 1) ? sampleLength - i * blockLength : blockLength;
+        DmaLinkedListItem* pItem = &pItems[i];
+        initLoopingListItem(pItem, pConvertedSamples + i * blockLength, length);
+        pItem->DMACCxLLI = (uint32_t)&pItems[(i + 1) % itemCount];
+        pItem->DMACCxControl |= DMACCxCONTROL_I;
     }
-    else
+}
+
+void DmaDac::startLooping(DmaLinkedListItem* pItem)
+{
+    uint32_t startCycles = DWT->CYCCNT;
+
+    stopTransfer();
+
+    m_pChannelTx->DMACCSrcAddr  = pItem->DMACCxSrcAddr;
+    m_pChannelTx->DMACCDestAddr = pItem->DMACCxDestAddr;
+    m_pChannelTx->DMACCControl  = pItem->DMACCxControl;
+    m_pChannelTx->DMACCLLI      = pItem->DMACCxLLI;
+    enableTransmitChannel();
+
+    m_pActiveListItem = pItem;
+    m_isLooping = true;
+    recordStart(startCycles);
+}
+
+void DmaDac::enableTransmitChannel()
+{
+    uint32_t peripheral = m_pacing == PACING_TIMER_MATCH ? DMA_PERIPHERAL_UART1TX_MAT1_0 : DMA_PERIPHERAL_DAC;
+
+    if (m_isArmed)
     {
-        m_pChannelTx->DMACCLLI      = 0;
+        // Hold the output at the first sample until triggered. Writing DACR also clears any stale DMA request.
+        LPC_DAC->DACR = *(uint32_t*)m_pChannelTx->DMACCSrcAddr;
     }
 
     // Enable transmit channel.
+    LPC_GPDMA->DMACIntTCClear = 1 << m_channelTx;
+    LPC_GPDMA->DMACIntErrClr = 1 << m_channelTx;
     m_pChannelTx->DMACCConfig = DMACCxCONFIG_ENABLE |
-                   (DMA_PERIPHERAL_DAC << DMACCxCONFIG_DEST_PERIPHERAL_SHIFT) |
-                   DMACCxCONFIG_TRANSFER_TYPE_M2P;
+                   (peripheral << DMACCxCONFIG_DEST_PERIPHERAL_SHIFT) |
+                   DMACCxCONFIG_TRANSFER_TYPE_M2P |
+                   DMACCxCONFIG_IE |
+                   DMACCxCONFIG_ITC;
+
+    if (!m_isArmed)
+        startPacing();
+}
 
-    // Turn on DMA transmit requests in DAC.
-    static const uint32_t CNT_ENA = (1 << 2);
-    static const uint32_t DMA_ENA = (1 << 3);
-    LPC_DAC->DACCTRL = CNT_ENA | DMA_ENA;
+void DmaDac::startPacing()
+{
+    if (m_pacing == PACING_TIMER_MATCH)
+    {
+        // Clear any stale match so that the first sample request comes a full sample time after starting.
+        LPC_TIM1->IR = IR_MR0;
+        LPC_TIM1->TCR = TCR_ENABLE;
+    }
+    else
+    {
+        // Turn on DMA transmit requests in DAC.
+        LPC_DAC->DACCTRL = DACCTRL_CNT_ENA | DACCTRL_DMA_ENA;
+    }
+}
 
-    m_isLooping = loopSamples;
+void DmaDac::stopPacing()
+{
+    LPC_DAC->DACCTRL = 0;
+    if (m_pacing == PACING_TIMER_MATCH)
+        LPC_TIM1->TCR = TCR_RESET;
+}
+
+void DmaDac::arm()
+{
+    stop();
+    m_isArmed = true;
+}
+
+void DmaDac::disarm()
+{
+    m_isArmed = false;
+}
+
+void DmaDac::trigger()
+{
+    if (!m_isArmed)
+        return;
+    m_isArmed = false;
+    startPacing();
+}
+
+void DmaDac::startStreaming(uint32_t* pBlocks, size_t blockLength)
+{
+    uint32_t startCycles = DWT->CYCCNT;
+
+    stopTransfer();
+
+    m_pStreamBlocks = pBlocks;
+    m_streamBlockLength = blockLength;
+    m_nextStreamBlock = 0;
+    fillNextBlock();
+    fillNextBlock();
+
+    // Circular list of the two blocks with an interrupt as each one completes.
+    for (int i = 0 ; i < 2 ; i++)
+    {
+        DmaLinkedListItem* pItem = &m_streamListItems[i];
+        initLoopingListItem(pItem, pBlocks + i * blockLength, blockLength);
+        pItem->DMACCxLLI = (uint32_t)&m_streamListItems[i ^ 1];
+        pItem->DMACCxControl |= DMACCxCONTROL_I;
+    }
+
+    m_pChannelTx->DMACCSrcAddr  = m_streamListItems[0].DMACCxSrcAddr;
+    m_pChannelTx->DMACCDestAddr = m_streamListItems[0].DMACCxDestAddr;
+    m_pChannelTx->DMACCControl  = m_streamListItems[0].DMACCxControl;
+    m_pChannelTx->DMACCLLI      = m_streamListItems[0].DMACCxLLI;
+    m_isStreaming = true;
+    enableTransmitChannel();
+    recordStart(startCycles);
+}
+
+void DmaDac::fillBlock(uint32_t* pBlock, size_t blockLength)
+{
+    // Default to silence at mid-scale.
+    for (size_t i = 0 ; i < blockLength ; i++)
+    {
+        pBlock[i] = 0x8000;
+    }
+}
+
+void DmaDac::fillNextBlock()
+{
+    uint32_t startCycles = DWT->CYCCNT;
+    fillBlock(m_pStreamBlocks + m_nextStreamBlock * m_streamBlockLength, m_streamBlockLength);
+    uint32_t elapsedCycles = DWT->CYCCNT - startCycles;
+
+    m_nextStreamBlock ^= 1;
+    m_lastFillCycles = elapsedCycles;
+    if (elapsedCycles > m_maxFillCycles)
+        m_maxFillCycles = elapsedCycles;
+}
+
+void DmaDac::relink(DmaLinkedListItem* pItem, uint32_t dacTicksPerSample, uint32_t fraction)
+{
+    // Only one relink can be in flight at a time. The previous one completes within two passes of its samples.
+    while (!tryRelink(pItem, dacTicksPerSample, fraction))
+    {
+    }
+}
+
+bool DmaDac::tryRelink(DmaLinkedListItem* pItem, uint32_t dacTicksPerSample, uint32_t fraction)
+{
+    if (!m_isLooping || m_isArmed)
+    {
+        setDacTicksPerSample(dacTicksPerSample, fraction);
+        startLooping(pItem);
+        m_relinkCycles = DWT->CYCCNT;
+        return true;
+    }
+    if (isRelinkPending())
+        return false;
+
+    DmaLinkedListItem* pActive = m_pActiveListItem;
+    if (pItem == pActive)
+    {
+        setDacTicksPerSample(dacTicksPerSample, fraction);
+        m_relinkCycles = DWT->CYCCNT;
+        return true;
+    }
+
+    // The switch happens at the end of the last item in the active chain (the active item itself if it loops on its
+    // own). If the channel has already loaded that item then it makes one more pass through the active samples before
+    // switching. The last item raises the terminal count interrupt which updates the sample rate just as the new
+    // samples start playing.
+    //
+    // Tables no longer than the guard loop too quickly to ever find the channel outside of it. The interrupt handler
+    // checks that the channel really is in the new samples and the interrupt is enabled before the link is changed, so
+    // a reload which catches the update half way through can only raise an early interrupt, which is ignored.
+    DmaLinkedListItem* pLast = lastListItem(pActive);
+    uint32_t transferSize = pLast->DMACCxControl & DMACCxCONTROL_TRANSFER_SIZE_MASK;
+    uint32_t guardAddress = pLast->DMACCxSrcAddr + (transferSize - RELINK_GUARD_WORDS) * sizeof(uint32_t);
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (transferSize > RELINK_GUARD_WORDS && m_pChannelTx->DMACCSrcAddr >= guardAddress)
+    {
+        __set_PRIMASK(primask);
+        return false;
+    }
+
+    // The new item (or chain) is already looping back onto itself from initLoopingListItem(s) or cancelRelink().
+    m_pendingDacTicksPerSample = dacTicksPerSample;
+    m_pendingDacTicksFraction = fraction;
+    m_pPendingListItem = pItem;
+    m_pRelinkedListItem = pLast;
+    m_relinkSetInterrupt = (pLast->DMACCxControl & DMACCxCONTROL_I) == 0;
+    pLast->DMACCxControl |= DMACCxCONTROL_I;
+    pLast->DMACCxLLI = (uint32_t)pItem;
+    __set_PRIMASK(primask);
+    return true;
+}
+
+DmaLinkedListItem* DmaDac::lastListItem(DmaLinkedListItem* pHead)
+{
+    DmaLinkedListItem* pItem = pHead;
+    while (pItem->DMACCxLLI != (uint32_t)pHead && pItem->DMACCxLLI != 0)
+    {
+        pItem = (DmaLinkedListItem*)pItem->DMACCxLLI;
+    }
+    return pItem;
+}
+
+bool DmaDac::isChannelInListItem(const DmaLinkedListItem* pItem)
+{
+    uint32_t srcAddress = m_pChannelTx->DMACCSrcAddr;
+    uint32_t startAddress = pItem->DMACCxSrcAddr;
+    uint32_t endAddress = startAddress + (pItem->DMACCxControl & DMACCxCONTROL_TRANSFER_SIZE_MASK) * sizeof(uint32_t);
+    // The source address sits on the end of the samples for a moment before a looping item reloads.
+    return srcAddress >= startAddress && srcAddress <= endAddress;
+}
+
+uint32_t DmaDac::dmaInterruptHandler(void* pContext, uint32_t dmaInterruptStatus)
+{
+    DmaDac* pThis = (DmaDac*)pContext;
+    return pThis->handleDmaInterrupt(dmaInterruptStatus);
+}
+
+uint32_t DmaDac::handleDmaInterrupt(uint32_t dmaInterruptStatus)
+{
+    uint32_t channelMask = 1 << m_channelTx;
+
+    if ((dmaInterruptStatus & channelMask) == 0)
+    {
+        return 0;
+    }
+    if (LPC_GPDMA->DMACIntErrStat & channelMask)
+    {
+        // The channel is disabled by the error so get the output going again.
+        LPC_GPDMA->DMACIntErrClr = channelMask;
+        telemetryIncrement(&g_telemetry.dmaErrors);
+        restart();
+        return channelMask;
+    }
+    LPC_GPDMA->DMACIntTCClear = channelMask;
+
+    if (m_isStreaming)
+    {
+        // The block which just completed is now free to be refilled while the other one plays. If the other block has
+        // already finished too then the refill was too late and stale samples were played.
+        fillNextBlock();
+        if (LPC_GPDMA->DMACRawIntTCStat & channelMask)
+            telemetryIncrement(&g_telemetry.underruns);
+        return channelMask;
+    }
+
+    // Chains built for dithering interrupt at the end of every block, and a relink of a short table can raise one
+    // early, so the switch has only happened once the channel is actually into the new samples.
+    DmaLinkedListItem* pPending = m_pPendingListItem;
+    if (pPending && isChannelInListItem(pPending))
+    {
+        // The channel has just moved on to the pending item so switch to its sample rate and return the previously
+        // active item to its original looping state.
+        m_relinkCycles = DWT->CYCCNT;
+        setDacTicksPerSample(m_pendingDacTicksPerSample, m_pendingDacTicksFraction);
+        cancelRelink();
+        m_pActiveListItem = pPending;
+    }
+    else
+    {
+        ditherDacTicks();
+    }
+
+    return channelMask;
+}
+
+void DmaDac::cancelRelink()
+{
+    DmaLinkedListItem* pActive = m_pActiveListItem;
+    DmaLinkedListItem* pLast = m_pRelinkedListItem;
+
+    if (m_pPendingListItem && pActive && pLast)
+    {
+        // Only clear the interrupt if the relink added it. Dithered chains need theirs.
+        if (m_relinkSetInterrupt)
+            pLast->DMACCxControl &= ~DMACCxCONTROL_I;
+        pLast->DMACCxLLI = (uint32_t)pActive;
+    }
+    m_pPendingListItem = NULL;
+    m_pRelinkedListItem = NULL;
 }
 
 void DmaDac::convertSamplesToDacValues(uint32_t* pSamples, size_t sampleLength)
@@ -103,20 +529,78 @@ void DmaDac::convertSamplesToDacValues(uint32_t* pSamples, size_t sampleLength)
     for (size_t i = 0; i < sampleLength ; i++)
     {
         // NOTE: Keeping BIAS bit cleared to allow for 1MHz operation and clearing out lowest 6 bits.
-        pSamples[i] = pSamples[i] & (((1 << 10) -1) << 6);
+        pSamples[i] = pSamples[i] & DAC_VALUE_MASK;
     }
 }
 
 void DmaDac::stop()
+{
+    uint32_t startCycles = DWT->CYCCNT;
+
+    stopTransfer();
+    telemetryIncrement(&g_telemetry.stops);
+    telemetryRecord(&g_telemetry.lastStopCycles, &g_telemetry.maxStopCycles, DWT->CYCCNT - startCycles);
+}
+
+void DmaDac::stopTransfer()
 {
     haltDma();
-    while (isTransferring())
+    // An armed channel will never drain its FIFO since nothing is requesting the samples.
+    while (!m_isArmed && isTransferring())
     {
     }
-    LPC_DAC->DACCTRL = 0;
+    stopPacing();
     m_pChannelTx->DMACCConfig &= ~DMACCxCONFIG_ENABLE;
 
+    cancelRelink();
+    m_pActiveListItem = NULL;
     m_isLooping = false;
+    m_isStreaming = false;
+}
+
+void DmaDac::recordStart(uint32_t startCycles)
+{
+    // Includes the stopTransfer() at the start of each start so this is how long the output was interrupted.
+    telemetryIncrement(&g_telemetry.starts);
+    telemetryRecord(&g_telemetry.lastStartCycles, &g_telemetry.maxStartCycles, DWT->CYCCNT - startCycles);
+}
+
+bool DmaDac::restartIfStalled()
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bool isStalled = (m_isLooping || m_isStreaming) && (LPC_GPDMA->DMACEnbldChns & (1 << m_channelTx)) == 0;
+    if (isStalled)
+    {
+        telemetryIncrement(&g_telemetry.stalls);
+        restart();
+    }
+    __set_PRIMASK(primask);
+    return isStalled;
+}
+
+void DmaDac::restart()
+{
+    if (m_isStreaming)
+    {
+        startStreaming(m_pStreamBlocks, m_streamBlockLength);
+    }
+    else if (m_isLooping)
+    {
+        // A pending relink was already reported as done to the caller so restart on its samples.
+        DmaLinkedListItem* pItem = m_pActiveListItem;
+        if (m_pPendingListItem)
+        {
+            pItem = m_pPendingListItem;
+            setDacTicksPerSample(m_pendingDacTicksPerSample, m_pendingDacTicksFraction);
+        }
+        startLooping(pItem);
+    }
+    else
+    {
+        return;
+    }
+    telemetryIncrement(&g_telemetry.restarts);
 }
 
 void DmaDac::haltDma()
@@ -22,22 +22,148 @@
 class DmaDac : public AnalogOut
 {
 public:
+    // Bits of DACR which hold the 10-bit DAC value. BIAS is kept cleared to allow for 1MHz operation.
+    static const uint32_t DAC_VALUE_MASK = ((1 << 10) - 1) << 6;
+
     DmaDac(PinName pin);
-    ~DmaDac();
+    virtual ~DmaDac();
 
     void stop();
     void start(uint32_t* pSamples, size_t sampleLength, bool loopSamples);
+    void startConverted(uint32_t* pSamples, size_t sampleLength, bool loopSamples);
     void setSampleTime(uint32_t sampleTimeInNanoSeconds);
+    // fraction is the 16-bit fractional part of the tick count. With DAC counter pacing, list items which interrupt at
+    // the end of each block (see initLoopingListItems()) alternate the counter between dacTicksPerSample and
+    // dacTicksPerSample + 1 from block to block so that the long term sample rate includes the fraction. With TIMER1
+    // pacing the fraction is rounded to the nearest quarter tick (CPU clock) instead.
+    void setDacTicksPerSample(uint32_t dacTicksPerSample, uint32_t fraction = 0);
     bool isTransferring();
 
+    // Looping list items can be prepared ahead of time (ie. for presets) and then switched to with relink(). The switch
+    // happens in hardware at the end of a pass through the currently playing samples so there is no gap in the output.
+    void initLoopingListItem(DmaLinkedListItem* pItem, uint32_t* pConvertedSamples, size_t sampleLength);
+    // Splits the samples across a circular chain of itemCount list items which each interrupt on completion, giving
+    // the fractional tick count a chance to be dithered once per block. The chain starts at pItems[0].
+    void initLoopingListItems(DmaLinkedListItem* pItems, size_t itemCount, uint32_t* pConvertedSamples,
+                              size_t sampleLength);
+    void relink(DmaLinkedListItem* pItem, uint32_t dacTicksPerSample, uint32_t fraction = 0);
+    // Same as relink() but returns false instead of waiting if a previous relink is still pending or the channel is too
+    // close to the end of the active samples. Safe to call from interrupt handlers.
+    bool tryRelink(DmaLinkedListItem* pItem, uint32_t dacTicksPerSample, uint32_t fraction = 0);
+    bool isRelinkPending()
+    {
+        return m_pPendingListItem != NULL;
+    }
+    // DWT cycle count when the last relink reached the output, recorded from the terminal count interrupt.
+    uint32_t getRelinkCycles()
+    {
+        return m_relinkCycles;
+    }
+
+    // Streams from two ping-pong blocks of DAC values. Each time the DMA channel finishes a block, fillBlock() is called
+    // from the DMA interrupt to refill it while the other block plays. pBlocks must have room for 2 * blockLength words.
+    void startStreaming(uint32_t* pBlocks, size_t blockLength);
+    bool isStreaming()
+    {
+        return m_isStreaming;
+    }
+    uint32_t getLastFillCycles()
+    {
+        return m_lastFillCycles;
+    }
+    uint32_t getMaxFillCycles()
+    {
+        return m_maxFillCycles;
+    }
+    void resetFillCycles()
+    {
+        m_maxFillCycles = 0;
+    }
+
+    // Samples are paced either by the DAC's own counter or by TIMER1 match 0. TIMER1 is clocked at the full CPU rate so
+    // it gives 4 times finer sample rate control than the DAC counter, which runs at 1/4 the CPU clock. The quarter
+    // ticks are passed in the top 2 bits of setDacTicksPerSample()'s fraction or set directly with
+    // setTimerTicksPerSample().
+    enum PacingSource
+    {
+        PACING_DAC_COUNTER = 0,
+        PACING_TIMER_MATCH
+    };
+    void setPacing(PacingSource source);
+    PacingSource getPacing()
+    {
+        return m_pacing;
+    }
+    void setTimerTicksPerSample(uint32_t timerTicksPerSample);
+
+    // When armed, the next start configures DMA and presets the DAC output to the first sample but holds the pacing
+    // counter until trigger() is called. trigger() is safe to call from interrupt handlers (ie. a pin edge or timer)
+    // and only has to start the counter so the latency from the trigger() call to the first sample is fixed. Neither
+    // pacing source can be started by hardware though, so the overall latency still includes however long the calling
+    // interrupt took to be serviced. Give that interrupt a higher priority than the DMA interrupt so that it isn't held
+    // up by block refills.
+    void arm();
+    void disarm();
+    void trigger();
+    bool isArmed()
+    {
+        return m_isArmed;
+    }
+
+    // Looping or streamed output is restarted automatically after a DMA error. This catches any other way that the
+    // channel can end up disabled while it should still be running. Call it periodically from the main loop.
+    bool restartIfStalled();
+
+    static uint32_t calculateDacTicksPerSample(uint32_t sampleTimeInNanoSeconds);
+
 protected:
-    void convertSamplesToDacValues(uint32_t* pSamples, size_t sampleLength);
-    void haltDma();
+    // Called from the DMA interrupt handler (and startStreaming()) to fill in the next block of DAC values.
+    virtual void    fillBlock(uint32_t* pBlock, size_t blockLength);
+    void            fillNextBlock();
+
+    void            convertSamplesToDacValues(uint32_t* pSamples, size_t sampleLength);
+    void            startLooping(DmaLinkedListItem* pItem);
+    void            enableTransmitChannel();
+    void            startPacing();
+    void            setTimerMatch(uint32_t timerTicksPerSample);
+    void            ditherDacTicks();
+    static uint32_t ditherTicks(uint32_t* pAccumulator, uint32_t dacTicksPerSample, uint32_t fraction);
+    void            stopPacing();
+    // Same as stop() but not counted in the telemetry, for stopping the output on the way to starting it again.
+    void            stopTransfer();
+    void            haltDma();
+    void            cancelRelink();
+    bool            isChannelInListItem(const DmaLinkedListItem* pItem);
+    static DmaLinkedListItem* lastListItem(DmaLinkedListItem* pHead);
+    void            restart();
+    void            recordStart(uint32_t startCycles);
+    static uint32_t dmaInterruptHandler(void* pContext, uint32_t dmaInterruptStatus);
+    uint32_t        handleDmaInterrupt(uint32_t dmaInterruptStatus);
 
     LPC_GPDMACH_TypeDef*        m_pChannelTx;
     DmaLinkedListItem           m_dmaListItem;
+    DmaLinkedListItem           m_streamListItems[2];
+    DmaInterruptHandler         m_interruptHandler;
+    DmaLinkedListItem*          m_pActiveListItem;
+    DmaLinkedListItem* volatile m_pPendingListItem;
+    DmaLinkedListItem*          m_pRelinkedListItem;
+    volatile uint32_t           m_pendingDacTicksPerSample;
+    volatile uint32_t           m_pendingDacTicksFraction;
+    volatile uint32_t           m_relinkCycles;
+    uint32_t*                   m_pStreamBlocks;
+    size_t                      m_streamBlockLength;
+    uint32_t                    m_nextStreamBlock;
+    volatile uint32_t           m_lastFillCycles;
+    volatile uint32_t           m_maxFillCycles;
+    uint32_t                    m_dacTicksPerSample;
+    uint32_t                    m_dacTicksFraction;
+    uint32_t                    m_ditherAccumulator;
+    PacingSource                m_pacing;
     uint32_t                    m_channelTx;
     bool                        m_isLooping;
+    bool                        m_isStreaming;
+    bool                        m_relinkSetInterrupt;
+    volatile bool               m_isArmed;
 };
 
 #endif // DMA_DAC_H_
@@ -0,0 +1,122 @@
+/* Copyright (C) 2017  Adam Green (https://github.com/adamgreen)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <cmsis.h>
+#include <string.h>
+#include "FlashStore.h"
+
+
+#define FLASH_STORE_MAGIC           0x31534746 // 'FGS1'
+#define FLASH_STORE_BLOCK_SIZE      512
+
+#define IAP_LOCATION                0x1FFF1FF1
+#define IAP_PREPARE_SECTORS         50
+#define IAP_COPY_RAM_TO_FLASH       51
+#define IAP_ERASE_SECTORS           52
+#define IAP_CMD_SUCCESS             0
+
+typedef void (*IapEntry)(uint32_t* pCommand, uint32_t* pResult);
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t size;
+    uint32_t checksum;
+    uint8_t  data[FLASH_STORE_MAX_RECORD_SIZE];
+} FlashStoreRecord;
+
+// IAP requires the source of FLASH writes to be word aligned RAM.
+static FlashStoreRecord g_flashBuffer;
+
+
+static uint32_t sectorAddress(uint32_t sector);
+static uint32_t calculateChecksum(const void* pData, uint32_t size);
+static uint32_t callIap(uint32_t command, uint32_t param0, uint32_t param1, uint32_t param2, uint32_t param3);
+
+
+int flashStoreWrite(uint32_t sector, const void* pRecord, uint32_t size)
+{
+    uint32_t address = sectorAddress(sector);
+    uint32_t clockInKHz = SystemCoreClock / 1000;
+
+    if (size > FLASH_STORE_MAX_RECORD_SIZE)
+    {
+        return 0;
+    }
+
+    memset(&g_flashBuffer, 0xFF, sizeof(g_flashBuffer));
+    g_flashBuffer.magic = FLASH_STORE_MAGIC;
+    g_flashBuffer.size = size;
+    g_flashBuffer.checksum = calculateChecksum(pRecord, size);
+    memcpy(g_flashBuffer.data, pRecord, size);
+
+    if (callIap(IAP_PREPARE_SECTORS, sector, sector, 0, 0) != IAP_CMD_SUCCESS)
+        return 0;
+    if (callIap(IAP_ERASE_SECTORS, sector, sector, clockInKHz, 0) != IAP_CMD_SUCCESS)
+        return 0;
+    if (callIap(IAP_PREPARE_SECTORS, sector, sector, 0, 0) != IAP_CMD_SUCCESS)
+        return 0;
+    if (callIap(IAP_COPY_RAM_TO_FLASH, address, (uint32_t)&g_flashBuffer, FLASH_STORE_BLOCK_SIZE, clockInKHz) != IAP_CMD_SUCCESS)
+        return 0;
+
+    return 1;
+}
+
+int flashStoreRead(uint32_t sector, void* pRecord, uint32_t size)
+{
+    const FlashStoreRecord* pFlash = (const FlashStoreRecord*)sectorAddress(sector);
+
+    if (pFlash->magic != FLASH_STORE_MAGIC || pFlash->size != size)
+        return 0;
+    if (pFlash->checksum != calculateChecksum(pFlash->data, size))
+        return 0;
+
+    memcpy(pRecord, pFlash->data, size);
+    return 1;
+}
+
+static uint32_t sectorAddress(uint32_t sector)
+{
+    // Sectors 0 - 15 are 4k in size and the rest are 32k.
+    if (sector < 16)
+        return sector * 0x1000;
+    return 0x10000 + (sector - 16) * 0x8000;
+}
+
+static uint32_t calculateChecksum(const void* pData, uint32_t size)
+{
+    const uint8_t* p = (const uint8_t*)pData;
+    uint32_t       checksum = 0;
+
+    for (uint32_t i = 0 ; i < size ; i++)
+    {
+        checksum = (checksum << 1 | checksum >> 31) ^ p[i];
+    }
+    return ~checksum;
+}
+
+static uint32_t callIap(uint32_t command, uint32_t param0, uint32_t param1, uint32_t param2, uint32_t param3)
+{
+    static const IapEntry iapEntry = (IapEntry)IAP_LOCATION;
+    uint32_t              commandParams[5] = { command, param0, param1, param2, param3 };
+    uint32_t              results[5];
+
+    // FLASH (and therefore the vector table) is inaccessible while IAP is erasing or programming it.
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    iapEntry(commandParams, results);
+    __set_PRIMASK(primask);
+
+    return results[0];
+}
@@ -0,0 +1,50 @@
+/* Copyright (C) 2017  Adam Green (https://github.com/adamgreen)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef FLASH_STORE_H_
+#define FLASH_STORE_H_
+
+#include <stdint.h>
+
+// The last sectors of the LPC1768's 512k FLASH are set aside for persistent settings. Each setting record owns a whole
+// sector since IAP can only erase in sector granularity.
+#define FLASH_STORE_CALIBRATION_SECTOR      28
+#define FLASH_STORE_PRESET_SECTOR           29
+
+// Largest record which can be stored in a sector (IAP copies are done in 512 byte blocks, minus the record header).
+#define FLASH_STORE_MAX_RECORD_SIZE         (512 - 3 * sizeof(uint32_t))
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+// Erases the specified sector and writes the record to it. Interrupts are disabled for the ~100ms that the IAP routines
+// take to run. DMA transfers from AHB SRAM keep running so a looping sample table carries on playing, but no DMA
+// interrupts are serviced until the write is done, so anything which relies on them (streamed output, relinks) stalls.
+// Returns 1 on success and 0 on failure.
+int flashStoreWrite(uint32_t sector, const void* pRecord, uint32_t size);
+
+// Copies the record from the specified sector if it contains a valid record of the expected size. Returns 1 on success
+// and 0 if the sector was blank or corrupt.
+int flashStoreRead(uint32_t sector, void* pRecord, uint32_t size);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FLASH_STORE_H_
@@ -13,17 +13,65 @@
    limitations under the License.
 */
 #include <mbed.h>
+#include "FlashStore.h"
 #include "FrequencyGenerator.h"
+#include "Telemetry.h"
+
+
+// Number of times a table is built when measuring the cycle count. The minimum is used to filter out any interrupts
+// which happen to land in the middle of a run.
+#define TABLE_BENCHMARK_RUNS 8
+
+// Highest frequency covered by each calibration band.
+static const uint32_t g_calibrationBandLimits[FrequencyGenerator::CALIBRATION_BANDS] = { 1000, 10000, 50000, ~0U };
 
 
 FrequencyGenerator::FrequencyGenerator(PinName pin) : DmaDac(pin)
 {
     m_pSamples = (uint32_t*)dmaHeap0Alloc(sizeof(*m_pSamples) * SAMPLE_COUNT);
+    for (size_t i = 0 ; i < PRESET_COUNT ; i++)
+    {
+        m_presets[i].pSamples = (uint32_t*)dmaHeap0Alloc(sizeof(*m_pSamples) * SAMPLE_COUNT);
+        m_presets[i].frequency = 0;
+        m_presets[i].amplitude = 0;
+        m_presets[i].isValid = false;
+    }
+    m_pStreamBlocks = (uint32_t*)dmaHeap1Alloc(sizeof(*m_pStreamBlocks) * STREAM_BLOCK_LENGTH * 2);
+    m_pRetuneSamples = (uint32_t*)dmaHeap1Alloc(sizeof(*m_pRetuneSamples) * SAMPLE_COUNT);
+    m_retuneListIndex = 0;
+    m_isRetunePrepared = false;
+    m_retuneOutputCycles = 0;
+    m_isRetuneRelinked = false;
     m_isRunning = false;
     m_currSampleCount = 0;
-    m_currAmplitude = 0;
+    m_currBlockCount = 0;
+    m_currScale = 0;
+    m_currBias = 0;
+    m_dcLevel = 50;
+    m_currRatio = 0;
+    m_frequencyErrorPpb = 0;
+    m_isExactFrequencyMode = false;
+    m_isFractionalPacing = false;
+    m_modulation = MODULATION_NONE;
+    m_waveform = WAVEFORM_SINE;
+    for (size_t i = 0 ; i < MAX_TONES - 1 ; i++)
+    {
+        m_extraTones[i] = 0;
+    }
+    m_modulationRate = 0;
+    m_modulationDepth = 0;
+    m_carrierIncrement = 0;
+    m_modulationIncrement = 0;
+    m_modulationScale = 0;
+    m_gain = 0;
+    m_bias = 32768;
+    m_carrierPhase = 0;
+    m_modulationPhase = 0;
 
     generateSineWave();
+    resetCalibration();
+    loadCalibrationFromFlash();
+    loadPresetsFromFlash();
     setFrequency(1000);
     setAmplitude(100);
 }
@@ -42,6 +90,7 @@ FrequencyGenerator::~FrequencyGenerator()
 
 void FrequencyGenerator::setFrequency(uint32_t frequencyHz)
 {
+    countRetune(frequencyHz, m_waveform);
     m_frequency = frequencyHz;
     refresh();
 }
@@ -52,57 +101,740 @@ void FrequencyGenerator::setAmplitude(uint32_t amplitudePercentage)
     refresh();
 }
 
+void FrequencyGenerator::setModulation(ModulationType type, uint32_t rateHz, uint32_t depth)
+{
+    if (type >= MODULATION_COUNT)
+        type = MODULATION_NONE;
+    if (rateHz > MODULATION_RATE_MAX)
+        rateHz = MODULATION_RATE_MAX;
+    m_modulation = type;
+    m_modulationRate = rateHz;
+    m_modulationDepth = depth;
+    refresh();
+}
+
+void FrequencyGenerator::setWaveform(Waveform waveform)
+{
+    if (waveform >= WAVEFORM_COUNT)
+        waveform = WAVEFORM_SINE;
+    countRetune(m_frequency, waveform);
+    m_waveform = waveform;
+    refresh();
+}
+
+void FrequencyGenerator::setExtraTone(uint32_t index, uint32_t frequencyHz)
+{
+    // Tone 0 is always the main frequency.
+    if (index == 0 || index >= MAX_TONES)
+        return;
+    m_extraTones[index - 1] = frequencyHz;
+    refresh();
+}
+
+void FrequencyGenerator::setDcLevel(uint32_t levelPercentage)
+{
+    if (levelPercentage > 100)
+        levelPercentage = 100;
+    m_dcLevel = levelPercentage;
+    refresh();
+    rebuildPresets();
+}
+
+void FrequencyGenerator::setExactFrequencyMode(bool isExact)
+{
+    m_isExactFrequencyMode = isExact;
+    refresh();
+    rebuildPresets();
+}
+
+void FrequencyGenerator::setFractionalPacing(bool isFractional)
+{
+    m_isFractionalPacing = isFractional;
+    refresh();
+    rebuildPresets();
+}
+
+void FrequencyGenerator::countRetune(uint32_t frequencyHz, Waveform waveform)
+{
+    // Only changes to what is actually being output count. Settings which just rebuild the same tone don't.
+    if (m_isRunning && (frequencyHz != m_frequency || waveform != m_waveform))
+        telemetryIncrement(&g_telemetry.retunes);
+}
+
 void FrequencyGenerator::refresh()
 {
-    uint32_t sampleCount = 0;
-    uint32_t sampleTimeInNanoSeconds = 0;
-    uint32_t ratio = 0;
+    TableSize tableSize;
 
     if (!m_isRunning)
         return;
 
-    if (m_frequency <= 1000)
+    if (m_modulation != MODULATION_NONE || m_waveform != WAVEFORM_SINE)
+    {
+        refreshStream();
+        return;
+    }
+
+    calculateTableSize(m_frequency, &tableSize);
+    uint32_t     sampleCount = tableSize.sampleCount;
+    Calibration* pCalibration = calibrationForFrequency(m_frequency);
+    int32_t      scale = calculateTableScale(pCalibration, m_amplitude);
+    int32_t      bias = calculateBias(pCalibration);
+
+    bool         isNewLayout = m_currSampleCount != sampleCount || m_currBlockCount != tableSize.blockCount;
+
+    if (isNewLayout)
+    {
+        DmaDac::stopTransfer();
+    }
+
+    if (isNewLayout || m_currScale != scale || m_currBias != bias || m_currRatio != tableSize.ratio)
+    {
+        fillTable(m_pSamples, sampleCount, tableSize.ratio, scale, bias);
+    }
+
+    setDacTicksPerSample(tableSize.dacTicksPerSample, tableSize.dacTicksFraction);
+
+    if (isNewLayout)
+    {
+        initTableListItems(m_tableListItems, m_pSamples, &tableSize);
+        DmaDac::startLooping(m_tableListItems);
+    }
+
+    m_currSampleCount = sampleCount;
+    m_currBlockCount = tableSize.blockCount;
+    m_currScale = scale;
+    m_currBias = bias;
+    m_currRatio = tableSize.ratio;
+    m_frequencyErrorPpb = calculateTableErrorPpb(m_frequency, &tableSize);
+}
+
+void FrequencyGenerator::refreshStream()
+{
+    uint32_t modulationScale = 0;
+
+    switch (m_modulation)
+    {
+    case MODULATION_AM:
+        // Fraction of the amplitude removed at the troughs of the modulation, in Q16.
+        modulationScale = (m_modulationDepth > 100 ? 100 : m_modulationDepth) * 65536 / 100;
+        break;
+    case MODULATION_FM:
+        // Peak deviation of the carrier's phase increment.
+        modulationScale = ((uint64_t)(m_modulationDepth > STREAM_SAMPLE_RATE / 2 ? STREAM_SAMPLE_RATE / 2 : m_modulationDepth) << 32) /
+                          STREAM_SAMPLE_RATE;
+        break;
+    case MODULATION_PM:
+        // Peak deviation of the carrier's phase.
+        modulationScale = ((uint64_t)(m_modulationDepth > 180 ? 180 : m_modulationDepth) << 32) / 360;
+        break;
+    case MODULATION_BURST:
+        // Portion of the modulation period for which the carrier is on.
+        modulationScale = m_modulationDepth >= 100 ? 0xFFFFFFFF : ((uint64_t)m_modulationDepth << 32) / 100;
+        break;
+    default:
+        break;
+    }
+
+    uint32_t carrierHz = m_frequency;
+    if (m_modulation != MODULATION_NONE && carrierHz > (uint32_t)STREAM_CARRIER_MAX)
+        carrierHz = STREAM_CARRIER_MAX;
+    m_carrierIncrement = ((uint64_t)carrierHz << 32) / STREAM_SAMPLE_RATE;
+    m_modulationIncrement = ((uint64_t)m_modulationRate << 32) / STREAM_BLOCK_RATE;
+    m_modulationScale = modulationScale;
+    Calibration* pCalibration = calibrationForFrequency(m_frequency);
+    m_gain = calculateStreamGain(pCalibration, m_amplitude);
+    m_bias = calculateBias(pCalibration);
+    refreshSynth();
+
+    // Error of the carrier's phase increment, in units of 2^-32 Hz.
+    int64_t errorHz32 = (int64_t)((uint64_t)m_carrierIncrement * STREAM_SAMPLE_RATE) - ((int64_t)carrierHz << 32);
+    m_frequencyErrorPpb = (int32_t)((errorHz32 * 1000000000) / ((int64_t)m_frequency << 32));
+    // A clamped carrier shows up as a large negative error.
+    m_frequencyErrorPpb += (int32_t)(((int64_t)carrierHz - m_frequency) * 1000000000 / m_frequency);
+
+    if (!isStreaming())
+    {
+        // Table needs to be rebuilt when modulation is turned back off.
+        m_currSampleCount = 0;
+        m_carrierPhase = 0;
+        m_modulationPhase = 0;
+        setSampleTime(STREAM_SAMPLE_TIME_NS);
+        startStreaming(m_pStreamBlocks, STREAM_BLOCK_LENGTH);
+    }
+}
+
+void FrequencyGenerator::refreshSynth()
+{
+    uint32_t toneFrequencies[MAX_TONES];
+    uint32_t toneCount = 0;
+
+    if (m_waveform == WAVEFORM_MULTI_TONE)
+    {
+        toneFrequencies[0] = m_frequency;
+        for (size_t i = 0 ; i < MAX_TONES - 1 ; i++)
+        {
+            toneFrequencies[i + 1] = m_extraTones[i];
+            if (m_extraTones[i] != 0)
+                toneCount++;
+        }
+        toneCount++;
+    }
+
+    for (size_t i = 0 ; i < MAX_TONES ; i++)
+    {
+        if (toneCount > 0 && toneFrequencies[i] != 0)
+            m_synth.setTone(i, ((uint64_t)toneFrequencies[i] << 32) / STREAM_SAMPLE_RATE, m_gain / toneCount);
+        else
+            m_synth.setTone(i, 0, 0);
+    }
+
+    switch (m_waveform)
+    {
+    case WAVEFORM_WHITE_NOISE:
+        m_synth.setNoise(BlockSynth::NOISE_WHITE, m_gain);
+        break;
+    case WAVEFORM_PINK_NOISE:
+        m_synth.setNoise(BlockSynth::NOISE_PINK, m_gain);
+        break;
+    default:
+        m_synth.setNoise(BlockSynth::NOISE_NONE, 0);
+        break;
+    }
+    m_synth.setBias(m_bias);
+}
+
+void FrequencyGenerator::fillBlock(uint32_t* pBlock, size_t blockLength)
+{
+    if (m_waveform != WAVEFORM_SINE)
+    {
+        m_synth.fill(pBlock, blockLength);
+        return;
+    }
+
+    // The modulation source is only evaluated once per block.
+    int32_t  modulation = lookupSine(m_modulationPhase);
+    uint32_t increment = m_carrierIncrement;
+    uint32_t phaseOffset = 0;
+    int32_t  gain = m_gain;
+    int32_t  bias = m_bias;
+
+    switch (m_modulation)
+    {
+    case MODULATION_AM:
+        // Envelope swings between (100 - depth)% and 100% of the amplitude.
+        gain -= (int32_t)(((int64_t)gain * m_modulationScale * (32767 - modulation)) >> 32);
+        break;
+    case MODULATION_FM:
+        increment += (uint32_t)(((int64_t)m_modulationScale * modulation) >> 15);
+        break;
+    case MODULATION_PM:
+        phaseOffset = (uint32_t)(((int64_t)m_modulationScale * modulation) >> 15);
+        break;
+    case MODULATION_BURST:
+        if (m_modulationPhase >= m_modulationScale)
+            gain = 0;
+        break;
+    default:
+        break;
+    }
+    m_modulationPhase += m_modulationIncrement;
+
+    uint32_t phase = m_carrierPhase;
+    for (size_t i = 0 ; i < blockLength ; i++)
+    {
+        pBlock[i] = __USAT(bias + ((lookupSine(phase + phaseOffset) * gain) >> 15), 16) & DAC_VALUE_MASK;
+        phase += increment;
+    }
+    m_carrierPhase = phase;
+}
+
+void FrequencyGenerator::calculateTableSize(uint32_t frequencyHz, TableSize* pSize)
+{
+    uint32_t sampleTimeInNanoSeconds = 0;
+
+    pSize->dacTicksFraction = 0;
+    pSize->blockCount = 0;
+    if (m_isExactFrequencyMode && calculateExactTableSize(frequencyHz, pSize))
+        return;
+
+    pSize->periods = 1;
+    if (frequencyHz <= 1000)
     {
         // Used fixed resolution of 1000 samples per period when frequency <= 1000.
-        sampleCount = SAMPLE_COUNT;
-        ratio = 1 << 22;
-        sampleTimeInNanoSeconds = (1000000000 / sampleCount) / m_frequency;
+        pSize->sampleCount = SAMPLE_COUNT;
+        pSize->ratio = 1 << 22;
+        sampleTimeInNanoSeconds = (1000000000 / SAMPLE_COUNT) / frequencyHz;
     }
     else
     {
         // Use variable (lower) resolution of samples per period when frequency > 1000.
         sampleTimeInNanoSeconds = 1000;
-        sampleCount = 1000000 / m_frequency;
-        ratio = (1000ULL << 22) / sampleCount;
+        pSize->sampleCount = 1000000 / frequencyHz;
+        pSize->ratio = (1000ULL << 22) / pSize->sampleCount;
     }
+    pSize->dacTicksPerSample = calculateDacTicksPerSample(sampleTimeInNanoSeconds);
+
+    bool isTimerPacing = getPacing() == PACING_TIMER_MATCH;
+    if (isTimerPacing || m_isFractionalPacing)
+    {
+        // Go straight from the requested frequency to the DAC ticks per sample in 16.16 rather than through a
+        // truncated sample time.
+        uint64_t divisor = (uint64_t)frequencyHz * pSize->sampleCount;
+        uint64_t ticks16 = (((uint64_t)pSize->periods * (SystemCoreClock / 4) << 16) + divisor / 2) / divisor;
+        if (isTimerPacing)
+        {
+            // TIMER1 counts CPU clocks so it can pace to the nearest quarter of a DAC tick without any dithering.
+            ticks16 = (ticks16 + 0x2000) & ~0x3FFFULL;
+        }
+        else
+        {
+            pSize->blockCount = calculateBlockCount(pSize->sampleCount);
+            if (pSize->blockCount == 0)
+                ticks16 = (ticks16 + 0x8000) & ~0xFFFFULL;
+        }
+        pSize->dacTicksPerSample = (uint32_t)(ticks16 >> 16) - 1;
+        pSize->dacTicksFraction = (uint32_t)ticks16 & 0xFFFF;
+    }
+}
 
-    if (m_currSampleCount != sampleCount)
+uint32_t FrequencyGenerator::calculateBlockCount(uint32_t sampleCount)
+{
+    // The blocks have to be the same length for the dithered tick counts to average out exactly.
+    for (uint32_t blockCount = MAX_TABLE_BLOCKS ; blockCount > 0 ; blockCount--)
     {
-        DmaDac::stop();
+        if (sampleCount % blockCount == 0 && sampleCount / blockCount >= MIN_TABLE_BLOCK_LENGTH)
+            return blockCount;
     }
+    return 0;
+}
+
+void FrequencyGenerator::initTableListItems(DmaLinkedListItem* pItems, uint32_t* pSamples, const TableSize* pSize)
+{
+    if (pSize->blockCount > 0)
+        initLoopingListItems(pItems, pSize->blockCount, pSamples, pSize->sampleCount);
+    else
+        initLoopingListItem(pItems, pSamples, pSize->sampleCount);
+}
+
+bool FrequencyGenerator::calculateExactTableSize(uint32_t frequencyHz, TableSize* pSize)
+{
+    // Note: DAC runs at 1/4 the CPU core clock and TIMER1 at the full CPU clock. The output frequency is:
+    //  periods * clock / (ticksPerSample * sampleCount)
+    // so search for small numbers of periods and table lengths which hit the requested frequency most closely. Each
+    // period keeps at least 1/8 of the samples that the default table would use for this frequency.
+    uint32_t ticksPerDacTick = getPacing() == PACING_TIMER_MATCH ? 4 : 1;
+    uint32_t clock = SystemCoreClock / 4 * ticksPerDacTick;
+    uint32_t minTicks = clock / 1000000;
+    uint32_t maxTicks = DAC_MAX_TICKS * ticksPerDacTick;
+    // periods * clock has to fit in 32 bits, which limits TIMER1 pacing to fewer periods.
+    uint32_t maxPeriods = 0xFFFFFFFF / clock;
+    uint32_t bestTicks = 0;
+    uint32_t minSamplesPerPeriod = (frequencyHz <= 1000 ? (uint32_t)SAMPLE_COUNT : 1000000 / frequencyHz) / 8;
+    uint32_t bestError = ~0U;
+    uint64_t bestActual = 1;
 
-    if (m_currSampleCount != sampleCount || m_currAmplitude != m_amplitude)
+    if (minSamplesPerPeriod < MIN_SAMPLES_PER_PERIOD)
+        minSamplesPerPeriod = MIN_SAMPLES_PER_PERIOD;
+    if (maxPeriods > EXACT_MAX_PERIODS)
+        maxPeriods = EXACT_MAX_PERIODS;
+
+    for (uint32_t periods = 1 ; periods <= maxPeriods && bestError != 0 ; periods++)
     {
-        uint32_t offset = 32768 - ((32768 * m_amplitude) / 100);
-        uint32_t srcIndex = 0;
-        for (uint32_t i = 0 ; i < sampleCount ; i++)
+        uint32_t periodTicks = periods * clock;
+        // Tables any longer than this would need samples faster than the DAC can take them.
+        uint32_t maxSamples = periodTicks / (frequencyHz * minTicks);
+        if (maxSamples > SAMPLE_COUNT)
+            maxSamples = SAMPLE_COUNT;
+
+        // Longer tables are tried first since they give more samples per period for the same error.
+        for (uint32_t samples = maxSamples ; samples >= periods * minSamplesPerPeriod ; samples--)
         {
-            // Round fixed point value and convert to integer.
-            uint32_t src = (srcIndex + (1 << 21)) >> 22;
-            m_pSamples[i] = ((m_sineWave[src] * m_amplitude) / 100) + offset;
-            srcIndex += ratio;
+            uint32_t divisor = frequencyHz * samples;
+            uint32_t ticks = (periodTicks + divisor / 2) / divisor;
+            if (ticks > maxTicks)
+                break;
+
+            uint64_t actual = (uint64_t)divisor * ticks;
+            uint32_t error = (uint32_t)(actual > periodTicks ? actual - periodTicks : periodTicks - actual);
+            if ((uint64_t)error * bestActual < (uint64_t)bestError * actual)
+            {
+                bestError = error;
+                bestActual = actual;
+                pSize->sampleCount = samples;
+                pSize->periods = periods;
+                bestTicks = ticks;
+                if (error == 0)
+                    break;
+            }
         }
     }
+    if (bestError == ~0U)
+        return false;
+
+    pSize->dacTicksPerSample = bestTicks / ticksPerDacTick - 1;
+    pSize->dacTicksFraction = (bestTicks % ticksPerDacTick) << 14;
+    pSize->ratio = ((uint64_t)pSize->periods * SAMPLE_COUNT << 22) / pSize->sampleCount;
+    return true;
+}
+
+int32_t FrequencyGenerator::calculateTableErrorPpb(uint32_t frequencyHz, const TableSize* pSize)
+{
+    // Worked in 1/65536ths of a DAC tick to include the dithered fraction. The difference is scaled by 10^6 and the
+    // divisor by 10^-3 so that the intermediate values stay inside 64 bits.
+    int64_t periodTicks16 = (int64_t)pSize->periods * (SystemCoreClock / 4) << 16;
+    int64_t ticks16 = ((int64_t)(pSize->dacTicksPerSample + 1) << 16) + pSize->dacTicksFraction;
+    int64_t actual16 = (int64_t)frequencyHz * pSize->sampleCount * ticks16;
+
+    return (int32_t)(((periodTicks16 - actual16) * 1000000) / (actual16 / 1000));
+}
+
+FrequencyGenerator::Calibration* FrequencyGenerator::calibrationForFrequency(uint32_t frequencyHz)
+{
+    size_t band = 0;
+    while (frequencyHz > g_calibrationBandLimits[band])
+    {
+        band++;
+    }
+    return &m_calibration[band];
+}
+
+int32_t FrequencyGenerator::calculateBias(const Calibration* pCalibration)
+{
+    // The DC level is a DAC setting too so it is subject to the same gain error as the waveform. Half of the DAC's
+    // 64 count step is added so that masking off the low bits rounds rather than truncates.
+    int32_t dcOffset = (((int32_t)m_dcLevel - 50) * 65536) / 100;
+    return 32768 + (int32_t)(((int64_t)dcOffset * pCalibration->gain) >> 16) + pCalibration->offset + 32;
+}
+
+int32_t FrequencyGenerator::calculateTableScale(const Calibration* pCalibration, uint32_t amplitude)
+{
+    return (int32_t)(((uint64_t)amplitude * pCalibration->gain << TABLE_SCALE_SHIFT) / (100 * 65536));
+}
 
-    setSampleTime(sampleTimeInNanoSeconds);
+int32_t FrequencyGenerator::calculateStreamGain(const Calibration* pCalibration, uint32_t amplitude)
+{
+    return (int32_t)(((uint64_t)amplitude * pCalibration->gain << 15) / (100 * 65536));
+}
 
-    if (m_currSampleCount != sampleCount)
+void FrequencyGenerator::fillTable(uint32_t* pDest, uint32_t sampleCount, uint32_t ratio, int32_t scale, int32_t bias)
+{
+    TableBuildParams params;
+
+    params.pSource = m_sineWave;
+    params.sourceLength = SAMPLE_COUNT;
+    params.ratio = ratio;
+    params.scale = scale;
+    params.bias = bias;
+    buildTable(pDest, sampleCount, &params);
+}
+
+uint32_t FrequencyGenerator::measureTableBuildCycles(void* pDest, bool isHalfword, uint32_t sampleCount, uint32_t ratio,
+                                                     int32_t scale)
+{
+    TableBuildParams params;
+    uint32_t         minCycles = ~0U;
+
+    params.pSource = m_sineWave;
+    params.sourceLength = SAMPLE_COUNT;
+    params.ratio = ratio;
+    params.scale = scale;
+    params.bias = 32768;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    for (int i = 0 ; i < TABLE_BENCHMARK_RUNS ; i++)
     {
-        DmaDac::start(m_pSamples, sampleCount, true);
+        uint32_t startCycles = DWT->CYCCNT;
+        if (isHalfword)
+            buildTable((uint16_t*)pDest, sampleCount, &params);
+        else
+            buildTable((uint32_t*)pDest, sampleCount, &params);
+        uint32_t elapsedCycles = DWT->CYCCNT - startCycles;
+        if (elapsedCycles < minCycles)
+            minCycles = elapsedCycles;
     }
+    return minCycles;
+}
 
-    m_currSampleCount = sampleCount;
-    m_currAmplitude = m_amplitude;
+int32_t FrequencyGenerator::simulatePacingErrorPpb(uint32_t frequencyHz, bool isFractional, uint32_t seconds)
+{
+    TableSize tableSize;
+    bool      wasFractional = m_isFractionalPacing;
+
+    m_isFractionalPacing = isFractional;
+    calculateTableSize(frequencyHz, &tableSize);
+    m_isFractionalPacing = wasFractional;
+
+    // TIMER1 counts CPU clocks so its quarter ticks add directly to each sample. The DAC counter only gets its
+    // fraction from ditherDacTicks(), which runs from the interrupt at the start of each block. By then the counter
+    // has already been reloaded for the block's first sample, so that sample still takes the previous block's count.
+    uint32_t quarterTicks = getPacing() == PACING_TIMER_MATCH ? tableSize.dacTicksFraction >> 14 : 0;
+    uint32_t blockCount = tableSize.blockCount > 0 ? tableSize.blockCount : 1;
+    uint32_t blockLength = tableSize.sampleCount / blockCount;
+    uint64_t periods = ((uint64_t)frequencyHz * seconds + tableSize.periods - 1) / tableSize.periods * tableSize.periods;
+    uint32_t blocks = (uint32_t)(periods / tableSize.periods) * blockCount;
+    uint32_t accumulator = 0;
+    uint32_t prevTicks = tableSize.dacTicksPerSample;
+    uint64_t totalClocks = 0;
+    for (uint32_t i = 0 ; i < blocks ; i++)
+    {
+        uint32_t ticks = tableSize.dacTicksPerSample;
+        if (tableSize.blockCount > 0)
+            ticks = ditherTicks(&accumulator, tableSize.dacTicksPerSample, tableSize.dacTicksFraction);
+        totalClocks += 4 * (prevTicks + 1) + (blockLength - 1) * 4 * (ticks + 1) + blockLength * quarterTicks;
+        prevTicks = ticks;
+    }
+
+    // Played frequency is periods * clock / totalClocks. The divisor is scaled down instead of the error scaled up so
+    // that errors of several percent don't overflow.
+    int64_t errorClocks = (int64_t)(periods * SystemCoreClock) - (int64_t)(totalClocks * frequencyHz);
+    return (int32_t)((errorClocks * 1000) / (int64_t)((totalClocks * frequencyHz) / 1000000));
+}
+
+bool FrequencyGenerator::prepareRetune(uint32_t frequencyHz, uint32_t amplitudePercentage, Waveform waveform)
+{
+    Retune* pRetune = &m_retune;
+
+    if (m_isRetunePrepared)
+        return true;
+    if (frequencyHz < FREQUENCY_MIN || frequencyHz > FREQUENCY_MAX || amplitudePercentage > AMPLITUDE_MAX)
+        return false;
+    if (waveform >= WAVEFORM_COUNT)
+        waveform = WAVEFORM_SINE;
+    pRetune->frequency = frequencyHz;
+    pRetune->amplitude = amplitudePercentage;
+    pRetune->waveform = waveform;
+
+    if (waveform == WAVEFORM_SINE)
+    {
+        // The spare buffer is the one which was playing before the last commit so it can't be touched until that
+        // relink has completed.
+        if (isRelinkPending())
+            return false;
+
+        Calibration* pCalibration = calibrationForFrequency(frequencyHz);
+        calculateTableSize(frequencyHz, &pRetune->tableSize);
+        pRetune->scale = calculateTableScale(pCalibration, amplitudePercentage);
+        pRetune->bias = calculateBias(pCalibration);
+        pRetune->frequencyErrorPpb = calculateTableErrorPpb(frequencyHz, &pRetune->tableSize);
+        fillTable(m_pRetuneSamples, pRetune->tableSize.sampleCount, pRetune->tableSize.ratio, pRetune->scale, pRetune->bias);
+        initTableListItems(m_retuneListItems[m_retuneListIndex], m_pRetuneSamples, &pRetune->tableSize);
+    }
+    m_isRetunePrepared = true;
+    return true;
+}
+
+bool FrequencyGenerator::commitRetune()
+{
+    Retune* pRetune = &m_retune;
+
+    if (!m_isRetunePrepared || !m_isRunning)
+        return false;
+
+    if (pRetune->waveform == WAVEFORM_SINE)
+    {
+        if (!tryRelink(m_retuneListItems[m_retuneListIndex], pRetune->tableSize.dacTicksPerSample,
+                       pRetune->tableSize.dacTicksFraction))
+            return false;
+
+        countRetune(pRetune->frequency, pRetune->waveform);
+        m_isRetuneRelinked = true;
+        // The new table becomes the live one and the old one becomes spare once the relink completes.
+        uint32_t* pSamples = m_pSamples;
+        m_pSamples = m_pRetuneSamples;
+        m_pRetuneSamples = pSamples;
+        m_retuneListIndex ^= 1;
+        m_currSampleCount = pRetune->tableSize.sampleCount;
+        m_currBlockCount = pRetune->tableSize.blockCount;
+        m_currScale = pRetune->scale;
+        m_currBias = pRetune->bias;
+        m_currRatio = pRetune->tableSize.ratio;
+        m_frequencyErrorPpb = pRetune->frequencyErrorPpb;
+        m_frequency = pRetune->frequency;
+        m_amplitude = pRetune->amplitude;
+        m_modulation = MODULATION_NONE;
+        m_waveform = WAVEFORM_SINE;
+    }
+    else
+    {
+        countRetune(pRetune->frequency, pRetune->waveform);
+        m_frequency = pRetune->frequency;
+        m_amplitude = pRetune->amplitude;
+        m_modulation = MODULATION_NONE;
+        m_waveform = pRetune->waveform;
+        refresh();
+        // Streamed shapes reach the output within two blocks (250us) of the synthesizer being updated.
+        m_isRetuneRelinked = false;
+        m_retuneOutputCycles = DWT->CYCCNT;
+    }
+    m_isRetunePrepared = false;
+    return true;
+}
+
+bool FrequencyGenerator::savePreset(uint32_t index)
+{
+    if (index >= PRESET_COUNT)
+        return false;
+
+    // A preset which is currently being output (or about to be) must have been just recalled and therefore already holds
+    // the current settings. Rebuilding it would only risk glitching the output.
+    Preset* pPreset = &m_presets[index];
+    if (m_pActiveListItem == pPreset->listItems || m_pPendingListItem == pPreset->listItems)
+        return true;
+
+    buildPreset(pPreset, m_frequency, m_amplitude);
+    return true;
+}
+
+void FrequencyGenerator::buildPreset(Preset* pPreset, uint32_t frequencyHz, uint32_t amplitudePercentage)
+{
+    TableSize tableSize;
+
+    calculateTableSize(frequencyHz, &tableSize);
+    Calibration* pCalibration = calibrationForFrequency(frequencyHz);
+    fillTable(pPreset->pSamples, tableSize.sampleCount, tableSize.ratio,
+              calculateTableScale(pCalibration, amplitudePercentage), calculateBias(pCalibration));
+    initTableListItems(pPreset->listItems, pPreset->pSamples, &tableSize);
+
+    pPreset->dacTicksPerSample = tableSize.dacTicksPerSample;
+    pPreset->dacTicksFraction = tableSize.dacTicksFraction;
+    pPreset->frequencyErrorPpb = calculateTableErrorPpb(frequencyHz, &tableSize);
+    pPreset->frequency = frequencyHz;
+    pPreset->amplitude = amplitudePercentage;
+    pPreset->isValid = true;
+}
+
+void FrequencyGenerator::rebuildPresets()
+{
+    // Presets bake the calibration, DC level, pacing and exact frequency mode into their tables. Call this after
+    // refresh(), which moves the output off any recalled preset, otherwise the preset being output keeps its old table
+    // until it is next saved.
+    for (size_t i = 0 ; i < PRESET_COUNT ; i++)
+    {
+        Preset* pPreset = &m_presets[i];
+        if (!pPreset->isValid || m_pActiveListItem == pPreset->listItems || m_pPendingListItem == pPreset->listItems)
+            continue;
+        buildPreset(pPreset, pPreset->frequency, pPreset->amplitude);
+    }
+}
+
+bool FrequencyGenerator::recallPreset(uint32_t index)
+{
+    if (index >= PRESET_COUNT || !m_presets[index].isValid)
+        return false;
+
+    // Presets are plain sine tones so recalling one turns off any modulation or synthesis.
+    Preset* pPreset = &m_presets[index];
+    m_frequency = pPreset->frequency;
+    m_amplitude = pPreset->amplitude;
+    m_frequencyErrorPpb = pPreset->frequencyErrorPpb;
+    m_modulation = MODULATION_NONE;
+    m_waveform = WAVEFORM_SINE;
+    if (!m_isRunning)
+        return true;
+
+    relink(pPreset->listItems, pPreset->dacTicksPerSample, pPreset->dacTicksFraction);
+    telemetryIncrement(&g_telemetry.retunes);
+
+    // The next refresh() has to rebuild m_pSamples and switch back to it.
+    m_currSampleCount = 0;
+    return true;
+}
+
+bool FrequencyGenerator::storePresetsToFlash()
+{
+    PresetRecord records[PRESET_COUNT];
+
+    if (isStreaming())
+        return false;
+    for (size_t i = 0 ; i < PRESET_COUNT ; i++)
+    {
+        records[i].frequency = m_presets[i].frequency;
+        records[i].amplitude = m_presets[i].amplitude;
+        records[i].isValid = m_presets[i].isValid;
+    }
+    return flashStoreWrite(FLASH_STORE_PRESET_SECTOR, records, sizeof(records));
+}
+
+bool FrequencyGenerator::loadPresetsFromFlash()
+{
+    PresetRecord records[PRESET_COUNT];
+
+    if (!flashStoreRead(FLASH_STORE_PRESET_SECTOR, records, sizeof(records)))
+        return false;
+
+    for (size_t i = 0 ; i < PRESET_COUNT ; i++)
+    {
+        if (records[i].isValid)
+            buildPreset(&m_presets[i], records[i].frequency, records[i].amplitude);
+        else
+            m_presets[i].isValid = false;
+    }
+    return true;
+}
+
+void FrequencyGenerator::setCalibration(uint32_t frequencyHz, uint32_t gain, int32_t offset)
+{
+    Calibration* pCalibration = calibrationForFrequency(frequencyHz);
+
+    if (gain < CALIBRATION_GAIN_MIN)
+        gain = CALIBRATION_GAIN_MIN;
+    if (gain > CALIBRATION_GAIN_MAX)
+        gain = CALIBRATION_GAIN_MAX;
+    if (offset < -CALIBRATION_OFFSET_MAX)
+        offset = -CALIBRATION_OFFSET_MAX;
+    if (offset > CALIBRATION_OFFSET_MAX)
+        offset = CALIBRATION_OFFSET_MAX;
+    pCalibration->gain = gain;
+    pCalibration->offset = offset;
+    refresh();
+    rebuildPresets();
+}
+
+void FrequencyGenerator::getCalibration(uint32_t frequencyHz, uint32_t* pGain, int32_t* pOffset)
+{
+    Calibration* pCalibration = calibrationForFrequency(frequencyHz);
+    *pGain = pCalibration->gain;
+    *pOffset = pCalibration->offset;
+}
+
+void FrequencyGenerator::resetCalibration()
+{
+    for (size_t i = 0 ; i < CALIBRATION_BANDS ; i++)
+    {
+        m_calibration[i].gain = 65536;
+        m_calibration[i].offset = 0;
+    }
+    refresh();
+    rebuildPresets();
+}
+
+bool FrequencyGenerator::storeCalibrationToFlash()
+{
+    if (isStreaming())
+        return false;
+    return flashStoreWrite(FLASH_STORE_CALIBRATION_SECTOR, m_calibration, sizeof(m_calibration));
+}
+
+bool FrequencyGenerator::loadCalibrationFromFlash()
+{
+    Calibration calibration[CALIBRATION_BANDS];
+
+    if (!flashStoreRead(FLASH_STORE_CALIBRATION_SECTOR, calibration, sizeof(calibration)))
+        return false;
+    for (size_t i = 0 ; i < CALIBRATION_BANDS ; i++)
+    {
+        // Reject records holding gains which setCalibration() would never have allowed.
+        if (calibration[i].gain < CALIBRATION_GAIN_MIN || calibration[i].gain > CALIBRATION_GAIN_MAX)
+            return false;
+    }
+    for (size_t i = 0 ; i < CALIBRATION_BANDS ; i++)
+    {
+        m_calibration[i] = calibration[i];
+    }
+    refresh();
+    rebuildPresets();
+    return true;
 }
 
 void FrequencyGenerator::start()
@@ -111,9 +843,26 @@ void FrequencyGenerator::start()
     refresh();
 }
 
+void FrequencyGenerator::arm()
+{
+    // Restart the output from the beginning of its samples once armed.
+    DmaDac::arm();
+    m_currSampleCount = 0;
+    refresh();
+}
+
+void FrequencyGenerator::setPacing(PacingSource source)
+{
+    DmaDac::setPacing(source);
+    m_currSampleCount = 0;
+    refresh();
+    rebuildPresets();
+}
+
 void FrequencyGenerator::stop()
 {
     DmaDac::stop();
+    DmaDac::disarm();
     m_currSampleCount = 0;
     m_isRunning = false;
 }
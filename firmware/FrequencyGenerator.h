@@ -16,7 +16,9 @@
 #define FREQUENCY_GENERATOR_H_
 
 #include <mbed.h>
+#include "BlockSynth.h"
 #include "DmaDac.h"
+#include "TableBuilder.h"
 
 
 class FrequencyGenerator : protected DmaDac
@@ -32,21 +34,313 @@ public:
         return m_isRunning;
     }
 
+    // Restarts the output if its DMA channel has stopped unexpectedly. Call it periodically from the main loop.
+    bool restartIfStalled()
+    {
+        return DmaDac::restartIfStalled();
+    }
+
+    // Frequencies outside of this range can't be built into a sample table.
+    enum { FREQUENCY_MIN = 1, FREQUENCY_MAX = 100000, AMPLITUDE_MAX = 100 };
     void setFrequency(uint32_t frequencyHz);
     void setAmplitude(uint32_t amplitudePercentage);
+    uint32_t getFrequency()
+    {
+        return m_frequency;
+    }
+    uint32_t getAmplitude()
+    {
+        return m_amplitude;
+    }
+
+    // Exact frequency mode lets tables hold several whole periods so that the table length, number of periods and DAC
+    // sample rate can be picked to hit the requested frequency as closely as the DAC clock allows.
+    void setExactFrequencyMode(bool isExact);
+    bool isExactFrequencyMode()
+    {
+        return m_isExactFrequencyMode;
+    }
+    // Fractional pacing splits sine tables into blocks and alternates the DAC counter between neighbouring tick counts
+    // from block to block so that the average sample time keeps 16 fractional bits of a tick rather than being
+    // truncated to a whole one, leaving at most half of 1/65536 of a tick of error per sample. Tables too short to
+    // split into blocks of at least 64 samples are rounded to the nearest tick instead. Only applies to DAC counter
+    // pacing and exact frequency mode takes precedence over it.
+    void setFractionalPacing(bool isFractional);
+    bool isFractionalPacing()
+    {
+        return m_isFractionalPacing;
+    }
+    // Difference between the frequency actually being output and the requested one, in parts per billion. This is
+    // relative to the nominal CPU clock so it doesn't include the crystal's error.
+    int32_t getFrequencyErrorPpb()
+    {
+        return m_frequencyErrorPpb;
+    }
+
+    // Arming restarts the output but holds it at the first sample until trigger() is called, so that the start of the
+    // waveform can be synchronized to an external edge or timer match. The pacing source can also be switched to
+    // TIMER1 match 0 for finer sample rate control.
+    using DmaDac::PacingSource;
+    using DmaDac::PACING_DAC_COUNTER;
+    using DmaDac::PACING_TIMER_MATCH;
+    void arm();
+    void trigger()
+    {
+        DmaDac::trigger();
+    }
+    bool isArmed()
+    {
+        return DmaDac::isArmed();
+    }
+    void setPacing(PacingSource source);
+    PacingSource getPacing()
+    {
+        return DmaDac::getPacing();
+    }
+
+    // Modulation is applied per streamed block of STREAM_BLOCK_LENGTH samples. The depth parameter is interpreted
+    // according to the type of modulation:
+    //  AM    - Modulation depth as percentage (0 - 100).
+    //  FM    - Peak frequency deviation in Hz.
+    //  PM    - Peak phase deviation in degrees.
+    //  BURST - Percentage of each modulation period for which the carrier is on.
+    enum ModulationType
+    {
+        MODULATION_NONE = 0,
+        MODULATION_AM,
+        MODULATION_FM,
+        MODULATION_PM,
+        MODULATION_BURST,
+        MODULATION_COUNT
+    };
+    void setModulation(ModulationType type, uint32_t rateHz, uint32_t depth);
+    ModulationType getModulation()
+    {
+        return m_modulation;
+    }
+
+    // Shapes other than WAVEFORM_SINE are synthesized block by block and streamed like modulated sine waves. The
+    // multi-tone shape mixes the main frequency with up to MAX_TONES - 1 extra tones, splitting the amplitude evenly
+    // between them. Modulation only applies to WAVEFORM_SINE.
+    enum Waveform
+    {
+        WAVEFORM_SINE = 0,
+        WAVEFORM_MULTI_TONE,
+        WAVEFORM_WHITE_NOISE,
+        WAVEFORM_PINK_NOISE,
+        WAVEFORM_COUNT
+    };
+    enum { MAX_TONES = BlockSynth::MAX_TONES };
+    void setWaveform(Waveform waveform);
+    void setExtraTone(uint32_t index, uint32_t frequencyHz);
+    Waveform getWaveform()
+    {
+        return m_waveform;
+    }
+
+    // Cycles spent filling each streamed block versus the cycles available in the time it takes to play a block.
+    uint32_t getStreamFillCycles()
+    {
+        return getMaxFillCycles();
+    }
+    uint32_t getStreamBlockCycles()
+    {
+        return (uint32_t)(((uint64_t)SystemCoreClock * STREAM_SAMPLE_TIME_NS * STREAM_BLOCK_LENGTH) / 1000000000);
+    }
+    void resetStreamFillCycles()
+    {
+        resetFillCycles();
+    }
+
+    // Calibration corrects the board's gain and offset errors separately for each frequency band, since DAC settling
+    // reduces the gain at higher frequencies. Gain is Q16 (65536 == 1.0) and the offset is in the same 0 - 65535 units
+    // as the samples:
+    //  output = ((sample - 32768) * gain) / 65536 + 32768 + offset
+    // Like storePresetsToFlash(), storeCalibrationToFlash() fails while streaming.
+    enum { CALIBRATION_BANDS = 4 };
+    void setCalibration(uint32_t frequencyHz, uint32_t gain, int32_t offset);
+    void getCalibration(uint32_t frequencyHz, uint32_t* pGain, int32_t* pOffset);
+    void resetCalibration();
+    bool storeCalibrationToFlash();
+    bool loadCalibrationFromFlash();
+
+    // Level that the waveform is centred on, as a percentage of full scale (50 is mid scale). Peaks which no longer
+    // fit are clipped.
+    void setDcLevel(uint32_t levelPercentage);
+    uint32_t getDcLevel()
+    {
+        return m_dcLevel;
+    }
+
+    // Retunes can be prepared ahead of time and then committed from an interrupt handler without blocking. Sine tables
+    // are built into a spare buffer when prepared and switched to by a relink at the end of the current pass through the
+    // samples. Other shapes are streamed so committing them only updates the synthesizer, although switching between
+    // a sine table and a streamed shape restarts the DMA channel. prepareRetune() fails for settings outside of the
+    // limits above or while a previous relink is still pending and commitRetune() fails if nothing is prepared or the
+    // relink can't be queued yet.
+    bool prepareRetune(uint32_t frequencyHz, uint32_t amplitudePercentage, Waveform waveform);
+    bool commitRetune();
+    void cancelRetune()
+    {
+        m_isRetunePrepared = false;
+    }
+    bool isRetunePrepared()
+    {
+        return m_isRetunePrepared;
+    }
+    // A committed sine retune only reaches the output at the end of the current pass through the samples. Once
+    // isRetuneInFlight() is false, getRetuneOutputCycles() gives the DWT cycle count at which the last commit did.
+    bool isRetuneInFlight()
+    {
+        return isRelinkPending();
+    }
+    uint32_t getRetuneOutputCycles()
+    {
+        return m_isRetuneRelinked ? getRelinkCycles() : m_retuneOutputCycles;
+    }
+
+    // Minimum number of CPU cycles taken to build a table of sampleCount samples into pDest (words, or halfwords if
+    // isHalfword is set) with the given Q22 source ratio and Q14 scale. Used to benchmark the table build kernels.
+    uint32_t measureTableBuildCycles(void* pDest, bool isHalfword, uint32_t sampleCount, uint32_t ratio, int32_t scale);
+    // Long term frequency error in ppb of the table which would be played for frequencyHz, with or without fractional
+    // pacing, found by counting the CPU clocks taken by the current pacing source over the given number of seconds of
+    // simulated output. The output isn't touched. Used to benchmark the pacing accuracy.
+    int32_t  simulatePacingErrorPpb(uint32_t frequencyHz, bool isFractional, uint32_t seconds);
+
+    // Presets hold fully built sample tables in DMA memory so that they can be switched to without rebuilding. Writing
+    // FLASH blocks the DMA interrupt which refills streamed blocks so storePresetsToFlash() fails while streaming.
+    enum { PRESET_COUNT = 3 };
+    bool savePreset(uint32_t index);
+    bool recallPreset(uint32_t index);
+    bool storePresetsToFlash();
+    bool loadPresetsFromFlash();
 
 protected:
     enum { SAMPLE_COUNT = 1000 };
+    enum { MIN_SAMPLES_PER_PERIOD = 10, EXACT_MAX_PERIODS = 100, DAC_MAX_TICKS = 65536 };
+    // Fractional pacing dithers once per block so blocks are kept long enough to bound the DMA interrupt rate.
+    enum { MAX_TABLE_BLOCKS = 8, MIN_TABLE_BLOCK_LENGTH = 64 };
+    // Modulated output is streamed at 200kHz in 25 sample blocks, giving an 8kHz modulation update rate.
+    enum { STREAM_SAMPLE_TIME_NS = 5000, STREAM_SAMPLE_RATE = 1000000000 / STREAM_SAMPLE_TIME_NS };
+    enum { STREAM_BLOCK_LENGTH = 25, STREAM_BLOCK_RATE = STREAM_SAMPLE_RATE / STREAM_BLOCK_LENGTH };
+    // Modulated carriers are clamped to keep at least 10 streamed samples per cycle.
+    enum { STREAM_CARRIER_MAX = STREAM_SAMPLE_RATE / 10 };
+    enum { MODULATION_RATE_MAX = STREAM_BLOCK_RATE / 2 };
+    enum { CALIBRATION_GAIN_MIN = 32768, CALIBRATION_GAIN_MAX = 131071, CALIBRATION_OFFSET_MAX = 8192 };
+
+    struct Preset
+    {
+        DmaLinkedListItem listItems[MAX_TABLE_BLOCKS];
+        uint32_t*         pSamples;
+        uint32_t          dacTicksPerSample;
+        uint32_t          dacTicksFraction;
+        uint32_t          frequency;
+        uint32_t          amplitude;
+        int32_t           frequencyErrorPpb;
+        bool              isValid;
+    };
+
+    struct TableSize
+    {
+        uint32_t sampleCount;
+        uint32_t periods;
+        uint32_t ratio;
+        uint32_t dacTicksPerSample;
+        // 16-bit fraction of a DAC tick dithered in over blockCount equal blocks (or rounded to quarter ticks for TIMER1
+        // pacing). blockCount is 0 for a table played from a single list item without any interrupts.
+        uint32_t dacTicksFraction;
+        uint32_t blockCount;
+    };
+
+    // Preset settings as stored in FLASH. The sample tables are rebuilt from these settings at startup.
+    struct PresetRecord
+    {
+        uint32_t frequency;
+        uint32_t amplitude;
+        uint32_t isValid;
+    };
+
+    struct Calibration
+    {
+        uint32_t gain;
+        int32_t  offset;
+    };
+
+    struct Retune
+    {
+        TableSize tableSize;
+        uint32_t  frequency;
+        uint32_t  amplitude;
+        Waveform  waveform;
+        int32_t   scale;
+        int32_t   bias;
+        int32_t   frequencyErrorPpb;
+    };
 
     void generateSineWave();
+    void countRetune(uint32_t frequencyHz, Waveform waveform);
     void refresh();
+    void refreshStream();
+    void refreshSynth();
+    virtual void fillBlock(uint32_t* pBlock, size_t blockLength);
+    int32_t lookupSine(uint32_t phase)
+    {
+        // Maps the full 32-bit phase range onto the SAMPLE_COUNT entries of the sine table and returns a signed sample.
+        return (int32_t)m_sineWave[((uint64_t)phase * SAMPLE_COUNT) >> 32] - 32768;
+    }
+    void calculateTableSize(uint32_t frequencyHz, TableSize* pSize);
+    bool calculateExactTableSize(uint32_t frequencyHz, TableSize* pSize);
+    int32_t calculateTableErrorPpb(uint32_t frequencyHz, const TableSize* pSize);
+    static uint32_t calculateBlockCount(uint32_t sampleCount);
+    void initTableListItems(DmaLinkedListItem* pItems, uint32_t* pSamples, const TableSize* pSize);
+    Calibration* calibrationForFrequency(uint32_t frequencyHz);
+    int32_t calculateBias(const Calibration* pCalibration);
+    int32_t calculateTableScale(const Calibration* pCalibration, uint32_t amplitude);
+    int32_t calculateStreamGain(const Calibration* pCalibration, uint32_t amplitude);
+    void fillTable(uint32_t* pDest, uint32_t sampleCount, uint32_t ratio, int32_t scale, int32_t bias);
+    void buildPreset(Preset* pPreset, uint32_t frequencyHz, uint32_t amplitudePercentage);
+    void rebuildPresets();
 
+    BlockSynth m_synth;
+    Calibration m_calibration[CALIBRATION_BANDS];
+    Preset    m_presets[PRESET_COUNT];
+    Retune    m_retune;
+    DmaLinkedListItem m_tableListItems[MAX_TABLE_BLOCKS];
+    DmaLinkedListItem m_retuneListItems[2][MAX_TABLE_BLOCKS];
     uint32_t* m_pSamples;
+    uint32_t* m_pRetuneSamples;
+    uint32_t  m_retuneListIndex;
+    uint32_t  m_retuneOutputCycles;
+    uint32_t* m_pStreamBlocks;
     uint32_t  m_sineWave[SAMPLE_COUNT];
     uint32_t  m_currSampleCount;
-    uint32_t  m_currAmplitude;
+    uint32_t  m_currBlockCount;
+    int32_t   m_currScale;
+    int32_t   m_currBias;
+    uint32_t  m_currRatio;
+    int32_t   m_frequencyErrorPpb;
     uint32_t  m_frequency;
     uint32_t  m_amplitude;
+    uint32_t  m_dcLevel;
+    uint32_t  m_extraTones[MAX_TONES - 1];
+    uint32_t  m_modulationRate;
+    uint32_t  m_modulationDepth;
+
+    // Streaming state shared with fillBlock() which runs in the DMA interrupt.
+    volatile uint32_t       m_carrierIncrement;
+    volatile uint32_t       m_modulationIncrement;
+    volatile uint32_t       m_modulationScale;
+    volatile int32_t        m_gain;
+    volatile int32_t        m_bias;
+    volatile ModulationType m_modulation;
+    volatile Waveform       m_waveform;
+    uint32_t                m_carrierPhase;
+    uint32_t                m_modulationPhase;
+
+    volatile bool m_isRetunePrepared;
+    bool      m_isRetuneRelinked;
+    bool      m_isExactFrequencyMode;
+    bool      m_isFractionalPacing;
     bool      m_isRunning;
 };
 
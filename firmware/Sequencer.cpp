@@ -0,0 +1,243 @@
+/* Copyright (C) 2017  Adam Green (https://github.com/adamgreen)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <string.h>
+#include <mbed.h>
+#include "Sequencer.h"
+
+
+// TIMER2 free runs at 1MHz while playing and match 0 interrupts at each step's time.
+#define PCONP_PCTIM2        (1 << 22)
+#define PCLKSEL1_TIM2_SHIFT 12
+#define PCLKSEL_CCLK        1
+#define TCR_ENABLE          (1 << 0)
+#define TCR_RESET           (1 << 1)
+#define MCR_MR0I            (1 << 0)
+#define IR_MR0              (1 << 0)
+
+// Match times closer than this to the current count might already have been passed by the time they are written.
+#define MIN_LEAD_US         10
+
+// How long to wait before trying again to commit a step which wasn't ready.
+#define RETRY_US            50
+
+// Delay from start() to the first pass.
+#define START_DELAY_US      1000
+
+
+Sequencer* Sequencer::s_pThis = NULL;
+
+
+Sequencer::Sequencer(FrequencyGenerator* pFreqGen)
+{
+    m_pFreqGen = pFreqGen;
+    m_stepCount = 0;
+    m_isPlaying = false;
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_totalErrorUs = 0;
+    m_measuredSteps = 0;
+    m_isStepInFlight = false;
+
+    LPC_SC->PCONP |= PCONP_PCTIM2;
+    LPC_SC->PCLKSEL1 = (LPC_SC->PCLKSEL1 & ~(3 << PCLKSEL1_TIM2_SHIFT)) | (PCLKSEL_CCLK << PCLKSEL1_TIM2_SHIFT);
+    LPC_TIM2->TCR = TCR_RESET;
+    LPC_TIM2->PR = SystemCoreClock / 1000000 - 1;
+    LPC_TIM2->MCR = MCR_MR0I;
+
+    s_pThis = this;
+    NVIC_SetVector(TIMER2_IRQn, (uint32_t)timerInterruptHandler);
+    NVIC_EnableIRQ(TIMER2_IRQn);
+}
+
+Sequencer::~Sequencer()
+{
+    stop();
+    NVIC_DisableIRQ(TIMER2_IRQn);
+    s_pThis = NULL;
+}
+
+bool Sequencer::addStep(uint32_t timeMs, uint32_t frequencyHz, uint32_t amplitudePercentage,
+                        FrequencyGenerator::Waveform waveform)
+{
+    if (m_isPlaying || m_stepCount >= MAX_STEPS)
+        return false;
+    if (frequencyHz < FrequencyGenerator::FREQUENCY_MIN || frequencyHz > FrequencyGenerator::FREQUENCY_MAX ||
+        amplitudePercentage > FrequencyGenerator::AMPLITUDE_MAX || waveform >= FrequencyGenerator::WAVEFORM_COUNT)
+        return false;
+    if (m_stepCount > 0 && timeMs < m_steps[m_stepCount - 1].timeMs)
+        return false;
+
+    Step* pStep = &m_steps[m_stepCount++];
+    pStep->timeMs = timeMs;
+    pStep->frequency = frequencyHz;
+    pStep->amplitude = amplitudePercentage;
+    pStep->waveform = waveform;
+    return true;
+}
+
+void Sequencer::clear()
+{
+    stop();
+    m_stepCount = 0;
+}
+
+bool Sequencer::start(uint32_t passCount, uint32_t passLengthMs)
+{
+    if (m_stepCount == 0)
+        return false;
+    stop();
+
+    uint32_t lastStepMs = m_steps[m_stepCount - 1].timeMs;
+    m_passLengthUs = (passLengthMs > lastStepMs ? passLengthMs : lastStepMs) * 1000;
+    m_passCount = passCount;
+    memset(&m_stats, 0, sizeof(m_stats));
+    m_totalErrorUs = 0;
+    m_measuredSteps = 0;
+    m_isStepInFlight = false;
+    m_stepIndex = 0;
+    m_isStepLate = false;
+
+    // The first step is built here so that it is ready on time.
+    prepareStep(0);
+
+    LPC_TIM2->TCR = TCR_RESET;
+    LPC_TIM2->IR = IR_MR0;
+    m_passStartUs = START_DELAY_US;
+    m_scheduledUs = m_passStartUs + m_steps[0].timeMs * 1000;
+    LPC_TIM2->MR0 = m_scheduledUs;
+    m_isPlaying = true;
+    LPC_TIM2->TCR = TCR_ENABLE;
+    return true;
+}
+
+void Sequencer::stop()
+{
+    LPC_TIM2->TCR = TCR_RESET;
+    LPC_TIM2->IR = IR_MR0;
+    NVIC_ClearPendingIRQ(TIMER2_IRQn);
+    if (m_isPlaying)
+        m_pFreqGen->cancelRetune();
+    m_isPlaying = false;
+}
+
+void Sequencer::poll()
+{
+    // The last step of a sequence is only timed from here since there's no later step interrupt to do it.
+    __disable_irq();
+    measureStep();
+    __enable_irq();
+
+    // Builds the next step as soon as the previous one has been committed.
+    if (m_isPlaying && !m_pFreqGen->isRetunePrepared())
+        prepareStep(m_stepIndex);
+}
+
+bool Sequencer::prepareStep(uint32_t index)
+{
+    Step* pStep = &m_steps[index];
+    return m_pFreqGen->prepareRetune(pStep->frequency, pStep->amplitude, pStep->waveform);
+}
+
+void Sequencer::getStats(Stats* pStats)
+{
+    __disable_irq();
+    measureStep();
+    *pStats = m_stats;
+    if (m_measuredSteps > 0)
+        pStats->meanErrorUs = (uint32_t)(m_totalErrorUs / m_measuredSteps);
+    __enable_irq();
+}
+
+void Sequencer::timerInterruptHandler()
+{
+    s_pThis->handleTimerInterrupt();
+}
+
+void Sequencer::handleTimerInterrupt()
+{
+    uint32_t now = LPC_TIM2->TC;
+    uint32_t nowCycles = DWT->CYCCNT;
+
+    LPC_TIM2->IR = IR_MR0;
+    if (!m_isPlaying)
+        return;
+
+    measureStep();
+    if (!m_pFreqGen->commitRetune())
+    {
+        if (!m_isStepLate)
+            m_stats.lateSteps++;
+        m_isStepLate = true;
+        LPC_TIM2->MR0 = now + RETRY_US;
+        return;
+    }
+
+    m_stats.steps++;
+    m_commitScheduledUs = m_scheduledUs;
+    m_commitUs = now;
+    m_commitCycles = nowCycles;
+    m_isStepInFlight = true;
+    m_isStepLate = false;
+    measureStep();
+
+    scheduleNextStep(now);
+}
+
+void Sequencer::measureStep()
+{
+    // Called with interrupts disabled or from the TIMER2 interrupt. The DMA interrupt records the cycle count at which
+    // a relinked table took over, which is converted back into TIMER2's microseconds relative to the commit.
+    if (!m_isStepInFlight || m_pFreqGen->isRetuneInFlight())
+        return;
+
+    m_isStepInFlight = false;
+    // A relink cancelled by the output being stopped never reached the output at all.
+    int32_t outputCycles = (int32_t)(m_pFreqGen->getRetuneOutputCycles() - m_commitCycles);
+    if (outputCycles < 0)
+        return;
+
+    uint32_t outputUs = m_commitUs + (uint32_t)outputCycles / (SystemCoreClock / 1000000);
+    uint32_t errorUs = outputUs - m_commitScheduledUs;
+    m_measuredSteps++;
+    m_totalErrorUs += errorUs;
+    if (errorUs > m_stats.maxErrorUs)
+        m_stats.maxErrorUs = errorUs;
+}
+
+void Sequencer::scheduleNextStep(uint32_t now)
+{
+    uint32_t index = m_stepIndex + 1;
+
+    if (index >= m_stepCount)
+    {
+        m_stats.passes++;
+        if (m_passCount != 0 && m_stats.passes >= m_passCount)
+        {
+            LPC_TIM2->TCR = TCR_RESET;
+            m_isPlaying = false;
+            return;
+        }
+        index = 0;
+        m_passStartUs += m_passLengthUs;
+    }
+    m_stepIndex = index;
+
+    // Steps are scheduled from the start of their pass rather than the previous step so that lateness doesn't
+    // accumulate. A step which is already due still needs a match time a little ahead of the counter.
+    m_scheduledUs = m_passStartUs + m_steps[index].timeMs * 1000;
+    uint32_t matchUs = m_scheduledUs;
+    if ((int32_t)(matchUs - now) < MIN_LEAD_US)
+        matchUs = LPC_TIM2->TC + MIN_LEAD_US;
+    LPC_TIM2->MR0 = matchUs;
+}
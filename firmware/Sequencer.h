@@ -0,0 +1,108 @@
+/* Copyright (C) 2017  Adam Green (https://github.com/adamgreen)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef SEQUENCER_H_
+#define SEQUENCER_H_
+
+#include <mbed.h>
+#include "FrequencyGenerator.h"
+
+
+// Plays a list of time stamped steps on a FrequencyGenerator. Steps are committed from the TIMER2 match interrupt so
+// their timing doesn't depend on the main loop or the serial link. The main loop has to call poll() so that each
+// step's sample table can be built ahead of its time. Only one Sequencer can exist since it owns TIMER2.
+class Sequencer
+{
+public:
+    enum { MAX_STEPS = 32 };
+
+    struct Stats
+    {
+        uint32_t steps;
+        uint32_t passes;
+        // Steps which weren't ready to commit at their time (table not built yet or previous relink still pending).
+        uint32_t lateSteps;
+        // Microseconds between each step's time and when its output actually changed. Sine steps change at the end of
+        // the pass through the previous table that they were committed in.
+        uint32_t maxErrorUs;
+        uint32_t meanErrorUs;
+    };
+
+    Sequencer(FrequencyGenerator* pFreqGen);
+    ~Sequencer();
+
+    // timeMs is from the start of each pass through the steps. Steps must be added in time order and steps with settings
+    // outside of the FrequencyGenerator's limits are rejected.
+    bool addStep(uint32_t timeMs, uint32_t frequencyHz, uint32_t amplitudePercentage, FrequencyGenerator::Waveform waveform);
+    void clear();
+    uint32_t getStepCount()
+    {
+        return m_stepCount;
+    }
+
+    // Plays passCount passes through the steps (0 repeats until stop() is called). Each pass lasts passLengthMs or up
+    // to the last step's time if that is longer.
+    bool start(uint32_t passCount, uint32_t passLengthMs);
+    void stop();
+    bool isPlaying()
+    {
+        return m_isPlaying;
+    }
+    // The last committed step hasn't reached the output yet.
+    bool isStepInFlight()
+    {
+        return m_isStepInFlight;
+    }
+    void poll();
+
+    void getStats(Stats* pStats);
+
+protected:
+    struct Step
+    {
+        uint32_t                     timeMs;
+        uint32_t                     frequency;
+        uint32_t                     amplitude;
+        FrequencyGenerator::Waveform waveform;
+    };
+
+    static void timerInterruptHandler();
+    void handleTimerInterrupt();
+    void scheduleNextStep(uint32_t now);
+    bool prepareStep(uint32_t index);
+    void measureStep();
+
+    static Sequencer*   s_pThis;
+
+    FrequencyGenerator* m_pFreqGen;
+    Step                m_steps[MAX_STEPS];
+    uint32_t            m_stepCount;
+    uint32_t            m_passCount;
+    uint32_t            m_passLengthUs;
+    uint32_t            m_passStartUs;
+    uint32_t            m_scheduledUs;
+    // Committed step whose output change hasn't been timed yet.
+    uint32_t            m_commitScheduledUs;
+    uint32_t            m_commitUs;
+    uint32_t            m_commitCycles;
+    uint32_t            m_measuredSteps;
+    uint64_t            m_totalErrorUs;
+    Stats               m_stats;
+    volatile uint32_t   m_stepIndex;
+    bool                m_isStepLate;
+    volatile bool       m_isStepInFlight;
+    volatile bool       m_isPlaying;
+};
+
+#endif // SEQUENCER_H_
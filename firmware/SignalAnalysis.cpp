@@ -0,0 +1,120 @@
+/* Copyright (C) 2017  Adam Green (https://github.com/adamgreen)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "SignalAnalysis.h"
+
+
+// Crossing positions are tracked in 1/256th of a sample.
+#define CROSSING_FRACTION_BITS  8
+
+// 2 * sqrt(2) in Q16 converts the RMS of a sine wave to its peak to peak amplitude.
+#define RMS_TO_PEAK_TO_PEAK     185364
+
+
+static uint32_t squareRoot(uint64_t value);
+
+
+void analyzeSignal(const uint32_t* pSamples, size_t sampleLength, uint32_t sampleRate, SignalMeasurement* pMeasurement)
+{
+    uint32_t minimum = ~0U;
+    uint32_t maximum = 0;
+    uint64_t sum = 0;
+
+    for (size_t i = 0 ; i < sampleLength ; i++)
+    {
+        uint32_t sample = pSamples[i];
+        if (sample < minimum)
+            minimum = sample;
+        if (sample > maximum)
+            maximum = sample;
+        sum += sample;
+    }
+    int32_t mean = (int32_t)(sum / sampleLength);
+
+    // Rising crossings of the mean only count once the signal has dropped below the hysteresis band, so noise on a
+    // slow edge can't be mistaken for extra periods.
+    int32_t  hysteresis = (maximum - minimum) / 8;
+    bool     isBelow = false;
+    uint32_t crossings = 0;
+    uint32_t firstCrossing = 0;
+    uint32_t lastCrossing = 0;
+    uint64_t sumOfSquares = 0;
+    for (size_t i = 0 ; i < sampleLength ; i++)
+    {
+        int32_t sample = pSamples[i];
+        int32_t delta = sample - mean;
+        sumOfSquares += (int64_t)delta * delta;
+
+        if (delta < -hysteresis)
+        {
+            isBelow = true;
+        }
+        else if (isBelow && delta >= 0 && i > 0)
+        {
+            // Interpolate between the previous sample and this one to find where the mean was crossed.
+            int32_t  prevDelta = (int32_t)pSamples[i - 1] - mean;
+            uint32_t fraction = ((uint32_t)-prevDelta << CROSSING_FRACTION_BITS) / (uint32_t)(delta - prevDelta);
+            uint32_t crossing = ((i - 1) << CROSSING_FRACTION_BITS) + fraction;
+
+            if (crossings == 0)
+                firstCrossing = crossing;
+            lastCrossing = crossing;
+            crossings++;
+            isBelow = false;
+        }
+    }
+
+    pMeasurement->minimum = minimum;
+    pMeasurement->maximum = maximum;
+    pMeasurement->mean = mean;
+    pMeasurement->peakToPeak = ((uint64_t)squareRoot(sumOfSquares / sampleLength) * RMS_TO_PEAK_TO_PEAK) >> 16;
+    pMeasurement->frequencyMilliHz = 0;
+    if (crossings >= 2 && lastCrossing > firstCrossing)
+    {
+        pMeasurement->frequencyMilliHz = (uint32_t)((((uint64_t)(crossings - 1) * sampleRate * 1000) << CROSSING_FRACTION_BITS) /
+                                                    (lastCrossing - firstCrossing));
+    }
+}
+
+void calculateSignalCorrection(const SignalMeasurement* pMeasurement, uint32_t expectedPeakToPeak,
+                               uint32_t expectedMean, SignalCorrection* pCorrection)
+{
+    pCorrection->gain = 65536;
+    if (pMeasurement->peakToPeak > 0)
+        pCorrection->gain = ((uint64_t)expectedPeakToPeak << 16) / pMeasurement->peakToPeak;
+    pCorrection->offset = (int32_t)expectedMean - (int32_t)pMeasurement->mean;
+}
+
+static uint32_t squareRoot(uint64_t value)
+{
+    uint64_t root = 0;
+    uint64_t bit = 1ULL << 62;
+
+    while (bit > value)
+        bit >>= 2;
+    while (bit != 0)
+    {
+        if (value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)root;
+}
@@ -0,0 +1,48 @@
+/* Copyright (C) 2017  Adam Green (https://github.com/adamgreen)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef SIGNAL_ANALYSIS_H_
+#define SIGNAL_ANALYSIS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Measurements of a captured periodic waveform. Levels are in the same 16-bit units as the DAC samples.
+struct SignalMeasurement
+{
+    uint32_t minimum;
+    uint32_t maximum;
+    uint32_t mean;
+    // Peak to peak amplitude of a sine wave with the same RMS as the capture. Less sensitive to noise than
+    // maximum - minimum.
+    uint32_t peakToPeak;
+    // 0 if fewer than two rising crossings of the mean were found.
+    uint32_t frequencyMilliHz;
+};
+
+// Corrections which cancel out the measured gain and offset errors when applied to the samples sent to the DAC:
+//  corrected = ((sample - 32768) * gain) / 65536 + 32768 + offset
+struct SignalCorrection
+{
+    uint32_t gain;
+    int32_t  offset;
+};
+
+
+void analyzeSignal(const uint32_t* pSamples, size_t sampleLength, uint32_t sampleRate, SignalMeasurement* pMeasurement);
+void calculateSignalCorrection(const SignalMeasurement* pMeasurement, uint32_t expectedPeakToPeak,
+                               uint32_t expectedMean, SignalCorrection* pCorrection);
+
+#endif // SIGNAL_ANALYSIS_H_
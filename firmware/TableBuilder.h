@@ -0,0 +1,148 @@
+/* Copyright (C) 2017  Adam Green (https://github.com/adamgreen)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef TABLE_BUILDER_H_
+#define TABLE_BUILDER_H_
+
+#include <mbed.h>
+#include "DmaDac.h"
+
+
+// Kernels which resample a 16-bit source waveform straight into DAC ready values, scaling, offsetting, clamping and
+// masking each sample in a single pass. Source indices are Q22 fixed point and wrap around the source table so that
+// tables can hold more than one period.
+enum { TABLE_INDEX_SHIFT = 22, TABLE_SCALE_SHIFT = 14 };
+
+struct TableBuildParams
+{
+    const uint32_t* pSource;
+    uint32_t        sourceLength;
+    // Step through the source per output sample, in Q22.
+    uint32_t        ratio;
+    // Q14 gain applied to the signed sample (16384 == 1.0) and the DAC value which it is centred on.
+    int32_t         scale;
+    int32_t         bias;
+};
+
+
+// Source index stepping for strides with a fractional part. The accumulator starts half a sample in so that truncating
+// it rounds to the nearest source sample and only one wrap check is needed per sample. A 1000 sample source fills
+// almost all 32 bits in Q22 so the wrap is checked before stepping rather than after, where the sum could overflow.
+class FractionalStride
+{
+public:
+    FractionalStride(const TableBuildParams* pParams)
+    {
+        m_index = 1 << (TABLE_INDEX_SHIFT - 1);
+        m_ratio = pParams->ratio;
+        m_wrap = (pParams->sourceLength << TABLE_INDEX_SHIFT) - pParams->ratio;
+    }
+
+    uint32_t next()
+    {
+        uint32_t index = m_index >> TABLE_INDEX_SHIFT;
+        if (m_index >= m_wrap)
+            m_index -= m_wrap;
+        else
+            m_index += m_ratio;
+        return index;
+    }
+
+protected:
+    uint32_t m_index;
+    uint32_t m_ratio;
+    uint32_t m_wrap;
+};
+
+// Source index stepping for whole number strides, which covers every single period table up to 1kHz.
+class IntegerStride
+{
+public:
+    IntegerStride(const TableBuildParams* pParams)
+    {
+        m_index = 0;
+        m_stride = pParams->ratio >> TABLE_INDEX_SHIFT;
+        m_limit = pParams->sourceLength;
+    }
+
+    uint32_t next()
+    {
+        uint32_t index = m_index;
+        m_index += m_stride;
+        if (m_index >= m_limit)
+            m_index -= m_limit;
+        return index;
+    }
+
+protected:
+    uint32_t m_index;
+    uint32_t m_stride;
+    uint32_t m_limit;
+};
+
+
+template <bool isUnityScale>
+static inline uint32_t tableValue(uint32_t source, int32_t scale, int32_t bias)
+{
+    // The bias has already had the source's 32768 offset (scaled) taken out of it so the source can be used unsigned.
+    int32_t value = isUnityScale ? (int32_t)source + bias : (int32_t)((source * scale) >> TABLE_SCALE_SHIFT) + bias;
+    return __USAT(value, 16) & DmaDac::DAC_VALUE_MASK;
+}
+
+template <typename OutputType, bool isUnityScale, class Stride>
+void buildTableKernel(OutputType* pDest, uint32_t count, const TableBuildParams* pParams)
+{
+    const uint32_t* pSource = pParams->pSource;
+    int32_t         scale = pParams->scale;
+    int32_t         bias = pParams->bias - ((32768 * scale) >> TABLE_SCALE_SHIFT);
+    Stride          stride(pParams);
+
+    // Unrolled 4 times with the stores grouped so that the compiler can use store multiple for word output.
+    for (uint32_t i = count >> 2 ; i > 0 ; i--)
+    {
+        uint32_t value0 = tableValue<isUnityScale>(pSource[stride.next()], scale, bias);
+        uint32_t value1 = tableValue<isUnityScale>(pSource[stride.next()], scale, bias);
+        uint32_t value2 = tableValue<isUnityScale>(pSource[stride.next()], scale, bias);
+        uint32_t value3 = tableValue<isUnityScale>(pSource[stride.next()], scale, bias);
+        pDest[0] = value0;
+        pDest[1] = value1;
+        pDest[2] = value2;
+        pDest[3] = value3;
+        pDest += 4;
+    }
+    for (uint32_t i = count & 3 ; i > 0 ; i--)
+    {
+        *pDest++ = tableValue<isUnityScale>(pSource[stride.next()], scale, bias);
+    }
+}
+
+// Picks the most specialized kernel for the given parameters. Halfword output holds the same DAC values in half the
+// memory.
+template <typename OutputType>
+void buildTable(OutputType* pDest, uint32_t count, const TableBuildParams* pParams)
+{
+    bool isUnityScale = pParams->scale == (1 << TABLE_SCALE_SHIFT);
+    bool isIntegerStride = (pParams->ratio & ((1 << TABLE_INDEX_SHIFT) - 1)) == 0;
+
+    if (isUnityScale && isIntegerStride)
+        buildTableKernel<OutputType, true, IntegerStride>(pDest, count, pParams);
+    else if (isUnityScale)
+        buildTableKernel<OutputType, true, FractionalStride>(pDest, count, pParams);
+    else if (isIntegerStride)
+        buildTableKernel<OutputType, false, IntegerStride>(pDest, count, pParams);
+    else
+        buildTableKernel<OutputType, false, FractionalStride>(pDest, count, pParams);
+}
+
+#endif // TABLE_BUILDER_H_
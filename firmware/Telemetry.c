@@ -0,0 +1,46 @@
+/* Copyright (C) 2017  Adam Green (https://github.com/adamgreen)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include <cmsis.h>
+#include "Telemetry.h"
+
+
+Telemetry g_telemetry;
+
+
+void telemetryIncrement(volatile uint32_t* pCounter)
+{
+    uint32_t value;
+
+    do
+    {
+        value = __LDREXW(pCounter) + 1;
+    } while (__STREXW(value, pCounter));
+}
+
+void telemetryRecord(volatile uint32_t* pLast, volatile uint32_t* pMax, uint32_t value)
+{
+    uint32_t max;
+
+    *pLast = value;
+    do
+    {
+        max = __LDREXW(pMax);
+        if (value <= max)
+        {
+            __CLREX();
+            return;
+        }
+    } while (__STREXW(value, pMax));
+}
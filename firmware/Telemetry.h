@@ -0,0 +1,68 @@
+/* Copyright (C) 2017  Adam Green (https://github.com/adamgreen)
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <stdint.h>
+
+
+// Health counters which are updated from both interrupt handlers and the main loop. Updates use LDREX/STREX so they
+// never need to disable interrupts and can't lose counts when an interrupt lands in the middle of one.
+typedef struct
+{
+    // DMA error interrupts raised by the DAC channel.
+    volatile uint32_t dmaErrors;
+    // Looping or streaming output found with its DMA channel no longer enabled.
+    volatile uint32_t stalls;
+    // Automatic restarts after an error or stall.
+    volatile uint32_t restarts;
+    // Streamed blocks which finished playing before the interrupt for the previous block had refilled it.
+    volatile uint32_t underruns;
+    // Changes to the output's frequency or shape, including preset recalls and sequencer steps. Amplitude, calibration
+    // and other settings which only rebuild the same tone aren't counted.
+    volatile uint32_t retunes;
+    // Number of times the output was stopped and started, and how long it took in CPU cycles. Stopping the channel on
+    // the way to restarting it is included in the start time rather than counted as a stop.
+    volatile uint32_t stops;
+    volatile uint32_t lastStopCycles;
+    volatile uint32_t maxStopCycles;
+    volatile uint32_t starts;
+    volatile uint32_t lastStartCycles;
+    volatile uint32_t maxStartCycles;
+    // Characters lost to UART receive overruns.
+    volatile uint32_t uartOverruns;
+    // Console commands overwritten by a later one before the main loop got to them.
+    volatile uint32_t droppedCommands;
+} Telemetry;
+
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+extern Telemetry g_telemetry;
+
+void telemetryIncrement(volatile uint32_t* pCounter);
+// Stores value as the last sample and raises the maximum if it is exceeded.
+void telemetryRecord(volatile uint32_t* pLast, volatile uint32_t* pMax, uint32_t value);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TELEMETRY_H_
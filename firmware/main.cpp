@@ -14,23 +14,87 @@
 */
 #include <ctype.h>
 #include <mbed.h>
+#include "BlockSynth.h"
+#include "DmaAdc.h"
 #include "FrequencyGenerator.h"
+#include "Sequencer.h"
+#include "SignalAnalysis.h"
+#include "Telemetry.h"
 
 
 #define AMPLITUDE_MIN 0
-#define AMPLITUDE_MAX 100
-#define FREQUENCY_MAX 100000
-#define FREQUENCY_MIN 1
+#define AMPLITUDE_MAX FrequencyGenerator::AMPLITUDE_MAX
+#define FREQUENCY_MAX FrequencyGenerator::FREQUENCY_MAX
+#define FREQUENCY_MIN FrequencyGenerator::FREQUENCY_MIN
+#define MAX_VALUES    4
+
+#define TRIGGER_SOFTWARE    0
+#define TRIGGER_EXTERNAL    1
+#define TRIGGER_TIMER       2
+
+// Length of simulated output which the pacing benchmark averages the frequency error over.
+#define PACING_BENCHMARK_SECONDS    100
+
+// ~11ms of samples at the ADC's ~185kHz burst rate.
+#define CAPTURE_LENGTH      2048
+
+// UART Line Status Register bits.
+#define LSR_RDR             (1 << 0)
+#define LSR_OE              (1 << 1)
 
 
 static Serial            g_serial(USBTX, USBRX);
 static volatile uint32_t g_frequency = 1000;
 static volatile uint32_t g_amplitude = 50;
 static volatile bool     g_charsEchoed = false;
+static volatile int32_t  g_presetToSave = -1;
+static volatile int32_t  g_presetToRecall = -1;
+static volatile bool     g_storePresets = false;
+static volatile uint32_t g_modulationType;
+static volatile uint32_t g_modulationRate;
+static volatile uint32_t g_modulationDepth;
+static volatile bool     g_modulationChanged = false;
+static volatile bool     g_showLoad = false;
+static volatile uint32_t g_waveform;
+static volatile uint32_t g_extraTones[FrequencyGenerator::MAX_TONES - 1];
+static volatile bool     g_waveformChanged = false;
+static volatile bool     g_runBenchmark = false;
+static volatile int32_t  g_exactFrequencyMode = -1;
+static volatile int32_t  g_fractionalPacing = -1;
+static volatile uint32_t g_triggerSource;
+static volatile uint32_t g_triggerDelay;
+static volatile bool     g_armRequested = false;
+static volatile bool     g_triggerRequested = false;
+static volatile int32_t  g_pacing = -1;
+static volatile bool     g_verifyRequested = false;
+static volatile int32_t  g_calibrate = -1;
+static volatile int32_t  g_dcLevel = -1;
+static volatile uint32_t g_step[MAX_VALUES];
+static volatile bool     g_addStep = false;
+static volatile bool     g_clearSequence = false;
+static volatile uint32_t g_passCount;
+static volatile uint32_t g_passLength;
+static volatile bool     g_startSequence = false;
+static volatile bool     g_stopSequence = false;
+static volatile bool     g_showTelemetry = false;
+static uint32_t          g_values[MAX_VALUES];
+static uint32_t          g_valueIndex;
 
 
 // Function Prototypes.
 static void serialRxHandler(void);
+static void clearValues(void);
+static void requestCommand(volatile bool* pFlag);
+static void requestValue(volatile int32_t* pRequest, int32_t value);
+static void printTelemetry(void);
+static void runSynthBenchmark(void);
+static void runTableBenchmark(FrequencyGenerator* pFreqGen, void* pScratch);
+static void runPacingBenchmark(FrequencyGenerator* pFreqGen);
+static void printPpm(int32_t errorPpb);
+static void printSequenceStats(Sequencer* pSequencer);
+static bool verifyOutput(FrequencyGenerator* pFreqGen, DmaAdc* pAdc, uint32_t* pCapture, SignalCorrection* pCorrection);
+static void applyCalibration(FrequencyGenerator* pFreqGen, uint32_t frequencyHz, const SignalCorrection* pCorrection);
+static void prioritizeTriggers(void);
 
 
 int main()
@@ -38,8 +102,16 @@ int main()
     static   DigitalOut         myled(LED1);
     static   Timer              ledTimer;
     static   FrequencyGenerator freqGen(p18);
+    static   InterruptIn        triggerIn(p8);
+    static   Timeout            triggerTimeout;
+    static   DmaAdc             adc(p20);
+    static   Sequencer          sequencer(&freqGen);
+    uint32_t*                   pCapture = (uint32_t*)dmaHeap1Alloc(CAPTURE_LENGTH * sizeof(*pCapture));
     uint32_t                    lastFrequency = 0;
     uint32_t                    lastAmplitude = 0;
+    SignalCorrection            lastCorrection;
+    uint32_t                    lastCorrectionFrequency = 0;
+    bool                        wasSequenceActive = false;
 
     g_serial.baud(230400);
     g_serial.attach(serialRxHandler);
@@ -54,7 +126,10 @@ int main()
         if (currFrequency != lastFrequency)
         {
             freqGen.setFrequency(currFrequency);
-            printf("%sFrequency=%lu\r\n", g_charsEchoed ? "\r\n" : "", currFrequency);
+            int32_t  errorPpb = freqGen.getFrequencyErrorPpb();
+            uint32_t absErrorPpb = errorPpb < 0 ? -errorPpb : errorPpb;
+            printf("%sFrequency=%lu (%c%lu.%03lu ppm)\r\n", g_charsEchoed ? "\r\n" : "", currFrequency,
+                   errorPpb < 0 ? '-' : '+', absErrorPpb / 1000, absErrorPpb % 1000);
             lastFrequency = currFrequency;
             g_charsEchoed = false;
         }
@@ -67,6 +142,246 @@ int main()
             g_charsEchoed = false;
         }
 
+        if (g_presetToRecall >= 0)
+        {
+            uint32_t preset = g_presetToRecall;
+            g_presetToRecall = -1;
+            if (freqGen.recallPreset(preset))
+            {
+                // Keep the frequency and amplitude changes above from undoing the recall.
+                lastFrequency = g_frequency = freqGen.getFrequency();
+                lastAmplitude = g_amplitude = freqGen.getAmplitude();
+                printf("%sPreset%lu: Frequency=%lu Amplitude=%lu%%\r\n", g_charsEchoed ? "\r\n" : "",
+                       preset, lastFrequency, lastAmplitude);
+            }
+            else
+            {
+                printf("%sPreset%lu is empty\r\n", g_charsEchoed ? "\r\n" : "", preset);
+            }
+            g_charsEchoed = false;
+        }
+
+        if (g_presetToSave >= 0)
+        {
+            uint32_t preset = g_presetToSave;
+            g_presetToSave = -1;
+            bool result = freqGen.savePreset(preset);
+            printf("%sPreset%lu %s\r\n", g_charsEchoed ? "\r\n" : "", preset, result ? "saved" : "not saved");
+            g_charsEchoed = false;
+        }
+
+        if (g_storePresets)
+        {
+            g_storePresets = false;
+            bool result = freqGen.storePresetsToFlash();
+            printf("%sPresets %s FLASH\r\n", g_charsEchoed ? "\r\n" : "", result ? "written to" : "failed to write to");
+            g_charsEchoed = false;
+        }
+
+        if (g_modulationChanged)
+        {
+            g_modulationChanged = false;
+            freqGen.setModulation((FrequencyGenerator::ModulationType)g_modulationType, g_modulationRate, g_modulationDepth);
+            printf("%sModulation=%d Rate=%lu Depth=%lu\r\n", g_charsEchoed ? "\r\n" : "",
+                   freqGen.getModulation(), g_modulationRate, g_modulationDepth);
+            g_charsEchoed = false;
+        }
+
+        if (g_showLoad)
+        {
+            g_showLoad = false;
+            uint32_t fillCycles = freqGen.getStreamFillCycles();
+            uint32_t blockCycles = freqGen.getStreamBlockCycles();
+            printf("%sBlock fill cycles: max=%lu of %lu (%lu%%)\r\n", g_charsEchoed ? "\r\n" : "",
+                   fillCycles, blockCycles, (fillCycles * 100) / blockCycles);
+            freqGen.resetStreamFillCycles();
+            g_charsEchoed = false;
+        }
+
+        if (g_waveformChanged)
+        {
+            g_waveformChanged = false;
+            for (uint32_t i = 1 ; i < FrequencyGenerator::MAX_TONES ; i++)
+            {
+                freqGen.setExtraTone(i, g_extraTones[i - 1]);
+            }
+            freqGen.setWaveform((FrequencyGenerator::Waveform)g_waveform);
+            printf("%sWaveform=%d\r\n", g_charsEchoed ? "\r\n" : "", freqGen.getWaveform());
+            g_charsEchoed = false;
+        }
+
+        if (g_runBenchmark)
+        {
+            g_runBenchmark = false;
+            if (g_charsEchoed)
+                printf("\r\n");
+            runSynthBenchmark();
+            runTableBenchmark(&freqGen, pCapture);
+            runPacingBenchmark(&freqGen);
+            g_charsEchoed = false;
+        }
+
+        if (g_exactFrequencyMode >= 0)
+        {
+            freqGen.setExactFrequencyMode(g_exactFrequencyMode != 0);
+            g_exactFrequencyMode = -1;
+            printf("%sExact frequency mode %s\r\n", g_charsEchoed ? "\r\n" : "",
+                   freqGen.isExactFrequencyMode() ? "on" : "off");
+            // Force the frequency to be printed again along with its new error.
+            lastFrequency = 0;
+            g_charsEchoed = false;
+        }
+
+        if (g_fractionalPacing >= 0)
+        {
+            freqGen.setFractionalPacing(g_fractionalPacing != 0);
+            g_fractionalPacing = -1;
+            printf("%sFractional pacing %s\r\n", g_charsEchoed ? "\r\n" : "",
+                   freqGen.isFractionalPacing() ? "on" : "off");
+            lastFrequency = 0;
+            g_charsEchoed = false;
+        }
+
+        if (g_armRequested)
+        {
+            static const char* triggerNames[] = { "T key", "rising edge on p8", "timer" };
+            uint32_t           triggerSource = g_triggerSource;
+
+            g_armRequested = false;
+            if (triggerSource > TRIGGER_TIMER)
+                triggerSource = TRIGGER_SOFTWARE;
+
+            // Only the selected trigger source is hooked up while armed.
+            triggerIn.rise(NULL);
+            triggerTimeout.detach();
+            prioritizeTriggers();
+            freqGen.arm();
+            if (triggerSource == TRIGGER_EXTERNAL)
+                triggerIn.rise(&freqGen, &FrequencyGenerator::trigger);
+            else if (triggerSource == TRIGGER_TIMER)
+                // Runs from the mbed us ticker (TIMER3) interrupt rather than a hardware match.
+                triggerTimeout.attach_us(&freqGen, &FrequencyGenerator::trigger, g_triggerDelay);
+            printf("%sArmed for %s\r\n", g_charsEchoed ? "\r\n" : "", triggerNames[triggerSource]);
+            g_charsEchoed = false;
+        }
+
+        if (g_triggerRequested)
+        {
+            g_triggerRequested = false;
+            freqGen.trigger();
+        }
+
+        if (g_pacing >= 0)
+        {
+            freqGen.setPacing(g_pacing ? FrequencyGenerator::PACING_TIMER_MATCH : FrequencyGenerator::PACING_DAC_COUNTER);
+            g_pacing = -1;
+            printf("%sPacing from %s\r\n", g_charsEchoed ? "\r\n" : "",
+                   freqGen.getPacing() == FrequencyGenerator::PACING_TIMER_MATCH ? "TIMER1 match" : "DAC counter");
+            g_charsEchoed = false;
+        }
+
+        if (g_verifyRequested)
+        {
+            g_verifyRequested = false;
+            if (g_charsEchoed)
+                printf("\r\n");
+            lastCorrectionFrequency = 0;
+            if (verifyOutput(&freqGen, &adc, pCapture, &lastCorrection))
+                lastCorrectionFrequency = freqGen.getFrequency();
+            g_charsEchoed = false;
+        }
+
+        if (g_calibrate >= 0)
+        {
+            if (g_charsEchoed)
+                printf("\r\n");
+            if (g_calibrate == 0 || lastCorrectionFrequency != 0)
+            {
+                if (g_calibrate == 0)
+                {
+                    freqGen.resetCalibration();
+                    printf("Calibration reset\r\n");
+                }
+                else
+                {
+                    applyCalibration(&freqGen, lastCorrectionFrequency, &lastCorrection);
+                    lastCorrectionFrequency = 0;
+                }
+                bool result = freqGen.storeCalibrationToFlash();
+                printf("Calibration %s FLASH\r\n", result ? "written to" : "failed to write to");
+            }
+            else
+            {
+                printf("Press V to measure a correction first\r\n");
+            }
+            g_calibrate = -1;
+            g_charsEchoed = false;
+        }
+
+        if (g_dcLevel >= 0)
+        {
+            freqGen.setDcLevel(g_dcLevel);
+            g_dcLevel = -1;
+            printf("%sDC level=%lu%%\r\n", g_charsEchoed ? "\r\n" : "", freqGen.getDcLevel());
+            g_charsEchoed = false;
+        }
+
+        if (g_addStep)
+        {
+            g_addStep = false;
+            bool result = sequencer.addStep(g_step[0], g_step[1], g_step[2], (FrequencyGenerator::Waveform)g_step[3]);
+            printf("%sStep%lu %s\r\n", g_charsEchoed ? "\r\n" : "", sequencer.getStepCount() - (result ? 1 : 0),
+                   result ? "added" : "not added");
+            g_charsEchoed = false;
+        }
+
+        if (g_clearSequence)
+        {
+            g_clearSequence = false;
+            sequencer.clear();
+            printf("%sSequence cleared\r\n", g_charsEchoed ? "\r\n" : "");
+            g_charsEchoed = false;
+        }
+
+        if (g_startSequence)
+        {
+            g_startSequence = false;
+            bool result = sequencer.start(g_passCount, g_passLength);
+            printf("%sSequence %s\r\n", g_charsEchoed ? "\r\n" : "", result ? "started" : "is empty");
+            g_charsEchoed = false;
+        }
+
+        if (g_stopSequence)
+        {
+            g_stopSequence = false;
+            sequencer.stop();
+        }
+
+        if (g_showTelemetry)
+        {
+            g_showTelemetry = false;
+            if (g_charsEchoed)
+                printf("\r\n");
+            printTelemetry();
+            g_charsEchoed = false;
+        }
+
+        freqGen.restartIfStalled();
+        sequencer.poll();
+        // Stats wait for the last step's output change to be timed as well.
+        bool isSequenceActive = sequencer.isPlaying() || sequencer.isStepInFlight();
+        if (wasSequenceActive && !isSequenceActive)
+        {
+            // Keep the frequency and amplitude changes above from undoing the last step.
+            lastFrequency = g_frequency = freqGen.getFrequency();
+            lastAmplitude = g_amplitude = freqGen.getAmplitude();
+            if (g_charsEchoed)
+                printf("\r\n");
+            printSequenceStats(&sequencer);
+            g_charsEchoed = false;
+        }
+        wasSequenceActive = isSequenceActive;
+
         if (ledTimer.read_ms() >= 250)
         {
             myled = !myled;
@@ -77,10 +392,15 @@ int main()
 
 static void serialRxHandler(void)
 {
-    static uint32_t frequency = 0;
-
-    while (g_serial.readable())
+    while (true)
     {
+        // Reading LSR clears the overrun flag so check it here rather than through readable().
+        uint8_t lineStatus = LPC_UART0->LSR;
+        if (lineStatus & LSR_OE)
+            telemetryIncrement(&g_telemetry.uartOverruns);
+        if ((lineStatus & LSR_RDR) == 0)
+            break;
+
         char curr = g_serial.getc();
         char lower = tolower(curr);
 
@@ -89,10 +409,18 @@ static void serialRxHandler(void)
             g_serial.putc(curr);
             g_charsEchoed = true;
 
-            frequency = frequency * 10 + (curr - '0');
+            g_values[g_valueIndex] = g_values[g_valueIndex] * 10 + (curr - '0');
+        }
+        else if (curr == ',' && g_valueIndex < MAX_VALUES - 1)
+        {
+            g_serial.putc(curr);
+            g_charsEchoed = true;
+
+            g_valueIndex++;
         }
         else if (curr == '\n')
         {
+            uint32_t frequency = g_values[0];
             if (frequency > FREQUENCY_MAX)
                 frequency = FREQUENCY_MAX;
             if (frequency < FREQUENCY_MIN)
@@ -103,28 +431,358 @@ static void serialRxHandler(void)
             g_charsEchoed = false;
 
             g_frequency = frequency;
-            frequency = 0;
+            clearValues();
         }
         else if (lower == 'a' && g_frequency > FREQUENCY_MIN)
         {
             g_frequency--;
-            frequency = 0;
+            clearValues();
 
         }
         else if (lower == 'd' && g_frequency < FREQUENCY_MAX)
         {
             g_frequency++;
-            frequency = 0;
+            clearValues();
         }
         else if ((curr == '+' || lower == 'w') && g_amplitude < AMPLITUDE_MAX)
         {
             g_amplitude++;
-            frequency = 0;
+            clearValues();
         }
         else if ((curr == '-' || lower == 's') && g_amplitude > AMPLITUDE_MIN)
         {
             g_amplitude--;
-            frequency = 0;
+            clearValues();
+        }
+        else if (lower == 'm')
+        {
+            // Number entered before M selects which preset to save current settings into.
+            requestValue(&g_presetToSave, g_values[0]);
+            clearValues();
+        }
+        else if (lower == 'r')
+        {
+            // Number entered before R selects which preset to recall.
+            requestValue(&g_presetToRecall, g_values[0]);
+            clearValues();
+        }
+        else if (lower == 'f')
+        {
+            requestCommand(&g_storePresets);
+            clearValues();
         }
+        else if (lower == 'o')
+        {
+            // Modulation is entered as type,rate,depth before the O.
+            g_modulationType = g_values[0];
+            g_modulationRate = g_values[1];
+            g_modulationDepth = g_values[2];
+            requestCommand(&g_modulationChanged);
+            clearValues();
+        }
+        else if (lower == 'l')
+        {
+            requestCommand(&g_showLoad);
+            clearValues();
+        }
+        else if (lower == 'h')
+        {
+            // Waveform shape is entered as shape,tone2,tone3,tone4 before the H.
+            g_waveform = g_values[0];
+            for (size_t i = 1 ; i < MAX_VALUES ; i++)
+            {
+                g_extraTones[i - 1] = g_values[i];
+            }
+            requestCommand(&g_waveformChanged);
+            clearValues();
+        }
+        else if (lower == 'b')
+        {
+            requestCommand(&g_runBenchmark);
+            clearValues();
+        }
+        else if (lower == 'g')
+        {
+            // Arming is entered as source,delay before the G.
+            g_triggerSource = g_values[0];
+            g_triggerDelay = g_values[1];
+            requestCommand(&g_armRequested);
+            clearValues();
+        }
+        else if (lower == 't')
+        {
+            requestCommand(&g_triggerRequested);
+            clearValues();
+        }
+        else if (lower == 'p')
+        {
+            // 1P paces samples from TIMER1 and 0P from the DAC's counter.
+            requestValue(&g_pacing, g_values[0] ? 1 : 0);
+            clearValues();
+        }
+        else if (lower == 'v')
+        {
+            requestCommand(&g_verifyRequested);
+            clearValues();
+        }
+        else if (lower == 'k')
+        {
+            // 1K applies the correction measured by the last V and 0K resets the calibration.
+            requestValue(&g_calibrate, g_values[0] ? 1 : 0);
+            clearValues();
+        }
+        else if (lower == 'c')
+        {
+            // Number entered before C is the DC level as a percentage of full scale.
+            requestValue(&g_dcLevel, g_values[0]);
+            clearValues();
+        }
+        else if (lower == 'e')
+        {
+            // Sequence steps are entered as time,frequency,amplitude,shape before the E.
+            for (size_t i = 0 ; i < MAX_VALUES ; i++)
+            {
+                g_step[i] = g_values[i];
+            }
+            requestCommand(&g_addStep);
+            clearValues();
+        }
+        else if (lower == 'n')
+        {
+            requestCommand(&g_clearSequence);
+            clearValues();
+        }
+        else if (lower == 'q')
+        {
+            // Playback is entered as passes,length before the Q.
+            g_passCount = g_values[0];
+            g_passLength = g_values[1];
+            requestCommand(&g_startSequence);
+            clearValues();
+        }
+        else if (lower == 'z')
+        {
+            requestCommand(&g_stopSequence);
+            clearValues();
+        }
+        else if (lower == 'i')
+        {
+            requestCommand(&g_showTelemetry);
+            clearValues();
+        }
+        else if (lower == 'x')
+        {
+            // 1X turns exact frequency mode on and 0X turns it back off.
+            requestValue(&g_exactFrequencyMode, g_values[0] ? 1 : 0);
+            clearValues();
+        }
+        else if (lower == 'u')
+        {
+            // 1U dithers the DAC counter for sub-tick sample times and 0U goes back to whole ticks.
+            requestValue(&g_fractionalPacing, g_values[0] ? 1 : 0);
+            clearValues();
+        }
+    }
+}
+
+static void requestCommand(volatile bool* pFlag)
+{
+    // The main loop hasn't got to the previous request yet.
+    if (*pFlag)
+        telemetryIncrement(&g_telemetry.droppedCommands);
+    *pFlag = true;
+}
+
+static void requestValue(volatile int32_t* pRequest, int32_t value)
+{
+    if (*pRequest >= 0)
+        telemetryIncrement(&g_telemetry.droppedCommands);
+    *pRequest = value;
+}
+
+static void clearValues(void)
+{
+    for (size_t i = 0 ; i < MAX_VALUES ; i++)
+    {
+        g_values[i] = 0;
+    }
+    g_valueIndex = 0;
+}
+
+static void runSynthBenchmark(void)
+{
+    static const uint32_t dacRates[] = { 1000000, 500000, 200000, 100000 };
+    static BlockSynth     synth;
+    static uint32_t       block[BlockSynth::MAX_BLOCK_LENGTH];
+    uint32_t              cyclesPerBlock[BlockSynth::MAX_TONES + 1];
+
+    // Cycles per block with 0 to MAX_TONES tones mixed in. Tone frequencies don't matter to the kernel.
+    synth.reset();
+    cyclesPerBlock[0] = synth.measureFillCycles(block, BlockSynth::MAX_BLOCK_LENGTH);
+    for (uint32_t tones = 1 ; tones <= BlockSynth::MAX_TONES ; tones++)
+    {
+        synth.setTone(tones - 1, 0x01000000 * tones, 32768 / BlockSynth::MAX_TONES);
+        cyclesPerBlock[tones] = synth.measureFillCycles(block, BlockSynth::MAX_BLOCK_LENGTH);
+        printf("%lu tone(s): %lu cycles/block (%lu.%02lu cycles/sample)\r\n",
+               tones, cyclesPerBlock[tones],
+               cyclesPerBlock[tones] / BlockSynth::MAX_BLOCK_LENGTH,
+               (cyclesPerBlock[tones] * 100 / BlockSynth::MAX_BLOCK_LENGTH) % 100);
+    }
+
+    synth.reset();
+    synth.setNoise(BlockSynth::NOISE_WHITE, 32768);
+    uint32_t whiteCycles = synth.measureFillCycles(block, BlockSynth::MAX_BLOCK_LENGTH);
+    synth.setNoise(BlockSynth::NOISE_PINK, 32768);
+    uint32_t pinkCycles = synth.measureFillCycles(block, BlockSynth::MAX_BLOCK_LENGTH);
+    printf("White noise: %lu cycles/block\r\nPink noise: %lu cycles/block\r\n", whiteCycles, pinkCycles);
+
+    // Number of tones which can be synthesized at each DAC rate using no more than half of the CPU.
+    for (size_t i = 0 ; i < sizeof(dacRates) / sizeof(dacRates[0]) ; i++)
+    {
+        uint64_t budgetPerBlock = ((uint64_t)SystemCoreClock * BlockSynth::MAX_BLOCK_LENGTH) / (2 * dacRates[i]);
+        uint32_t tones = 0;
+        while (tones < BlockSynth::MAX_TONES && cyclesPerBlock[tones + 1] <= budgetPerBlock)
+        {
+            tones++;
+        }
+        printf("%lukHz DAC rate: %lu tone(s) in 50%% CPU\r\n", dacRates[i] / 1000, tones);
+    }
+}
+
+static void runTableBenchmark(FrequencyGenerator* pFreqGen, void* pScratch)
+{
+    static const uint32_t sampleCounts[] = { 10, 25, 100, 333, 1000 };
+    static const int32_t  unityScale = 1 << TABLE_SCALE_SHIFT;
+    static const int32_t  halfScale = unityScale / 2;
+
+    if (pScratch == NULL)
+        return;
+
+    // Fractional ratios have a low bit set so that they don't take the integer stride kernel.
+    printf("Table build cycles: samples, fractional, unity scale, integer stride, unity+integer, halfword\r\n");
+    for (size_t i = 0 ; i < sizeof(sampleCounts) / sizeof(sampleCounts[0]) ; i++)
+    {
+        uint32_t count = sampleCounts[i];
+        uint32_t fractionalRatio = ((1000 << TABLE_INDEX_SHIFT) / count) | 1;
+        uint32_t integerRatio = (1000 / count) << TABLE_INDEX_SHIFT;
+        uint32_t fractional = pFreqGen->measureTableBuildCycles(pScratch, false, count, fractionalRatio, halfScale);
+        uint32_t unity = pFreqGen->measureTableBuildCycles(pScratch, false, count, fractionalRatio, unityScale);
+        uint32_t integer = pFreqGen->measureTableBuildCycles(pScratch, false, count, integerRatio, halfScale);
+        uint32_t both = pFreqGen->measureTableBuildCycles(pScratch, false, count, integerRatio, unityScale);
+        uint32_t halfword = pFreqGen->measureTableBuildCycles(pScratch, true, count, fractionalRatio, halfScale);
+        printf("%4lu, %lu (%lu.%02lu/sample), %lu, %lu, %lu, %lu\r\n",
+               count, fractional, fractional / count, (fractional * 100 / count) % 100, unity, integer, both, halfword);
+    }
+}
+
+static void runPacingBenchmark(FrequencyGenerator* pFreqGen)
+{
+    static const uint32_t frequencies[] = { 7, 13, 333, 777, 1003, 7000, 33333 };
+
+    // Each frequency is simulated with the current pacing source and table mode, first truncated to whole DAC ticks
+    // and then with fractional pacing.
+    printf("Pacing error over %us: frequency, whole ticks, fractional\r\n", PACING_BENCHMARK_SECONDS);
+    for (size_t i = 0 ; i < sizeof(frequencies) / sizeof(frequencies[0]) ; i++)
+    {
+        printf("%5lu, ", frequencies[i]);
+        printPpm(pFreqGen->simulatePacingErrorPpb(frequencies[i], false, PACING_BENCHMARK_SECONDS));
+        printf(", ");
+        printPpm(pFreqGen->simulatePacingErrorPpb(frequencies[i], true, PACING_BENCHMARK_SECONDS));
+        printf("\r\n");
+    }
+}
+
+static void printPpm(int32_t errorPpb)
+{
+    uint32_t absErrorPpb = errorPpb < 0 ? -errorPpb : errorPpb;
+    printf("%c%lu.%03lu ppm", errorPpb < 0 ? '-' : '+', absErrorPpb / 1000, absErrorPpb % 1000);
+}
+
+static bool verifyOutput(FrequencyGenerator* pFreqGen, DmaAdc* pAdc, uint32_t* pCapture, SignalCorrection* pCorrection)
+{
+    SignalMeasurement measurement;
+    SignalCorrection  correction;
+
+    if (pCapture == NULL || !pAdc->capture(pCapture, CAPTURE_LENGTH))
+    {
+        printf("ADC capture failed\r\n");
+        return false;
     }
+
+    uint32_t expectedPeakToPeak = (65535 * pFreqGen->getAmplitude()) / 100;
+    uint32_t expectedMean = 32768 + (((int32_t)pFreqGen->getDcLevel() - 50) * 65536) / 100;
+    analyzeSignal(pCapture, CAPTURE_LENGTH, pAdc->getSampleRate(), &measurement);
+    calculateSignalCorrection(&measurement, expectedPeakToPeak, expectedMean, &correction);
+
+    int32_t amplitudeError = (int32_t)measurement.peakToPeak - (int32_t)expectedPeakToPeak;
+    int32_t dcError = (int32_t)measurement.mean - (int32_t)expectedMean;
+    printf("Captured %u samples at %luHz (min=%lu max=%lu)\r\n",
+           CAPTURE_LENGTH, pAdc->getSampleRate(), measurement.minimum, measurement.maximum);
+    printf("Amplitude: %lu expected %lu (error %ld)\r\n", measurement.peakToPeak, expectedPeakToPeak, amplitudeError);
+    printf("DC: %lu expected %lu (error %ld)\r\n", measurement.mean, expectedMean, dcError);
+    if (measurement.frequencyMilliHz == 0)
+    {
+        printf("Frequency: too few periods captured to measure\r\n");
+    }
+    else
+    {
+        printf("Frequency: %lu.%03luHz expected %luHz\r\n",
+               measurement.frequencyMilliHz / 1000, measurement.frequencyMilliHz % 1000, pFreqGen->getFrequency());
+    }
+    if (pFreqGen->getFrequency() * 2 >= pAdc->getSampleRate())
+        printf("Frequency is above the ADC's Nyquist limit so the capture is aliased\r\n");
+    printf("Suggested correction: gain=%lu.%04lu offset=%ld\r\n",
+           correction.gain >> 16, ((correction.gain & 0xFFFF) * 10000) >> 16, correction.offset);
+    *pCorrection = correction;
+    return true;
+}
+
+static void applyCalibration(FrequencyGenerator* pFreqGen, uint32_t frequencyHz, const SignalCorrection* pCorrection)
+{
+    uint32_t gain;
+    int32_t  offset;
+
+    // The measurement was taken with the band's existing calibration in place so the correction builds on it.
+    pFreqGen->getCalibration(frequencyHz, &gain, &offset);
+    gain = ((uint64_t)gain * pCorrection->gain) >> 16;
+    offset += pCorrection->offset;
+    pFreqGen->setCalibration(frequencyHz, gain, offset);
+    pFreqGen->getCalibration(frequencyHz, &gain, &offset);
+    printf("Calibration for %luHz: gain=%lu.%04lu offset=%ld\r\n",
+           frequencyHz, gain >> 16, ((gain & 0xFFFF) * 10000) >> 16, offset);
+}
+
+static void printSequenceStats(Sequencer* pSequencer)
+{
+    Sequencer::Stats stats;
+
+    pSequencer->getStats(&stats);
+    printf("Sequence stopped: %lu steps in %lu passes, %lu late\r\n", stats.steps, stats.passes, stats.lateSteps);
+    printf("Step timing error: mean=%luus max=%luus\r\n", stats.meanErrorUs, stats.maxErrorUs);
+}
+
+static void printTelemetry(void)
+{
+    uint32_t cyclesPerUs = SystemCoreClock / 1000000;
+
+    printf("DMA errors=%lu stalls=%lu restarts=%lu underruns=%lu\r\n",
+           g_telemetry.dmaErrors, g_telemetry.stalls, g_telemetry.restarts, g_telemetry.underruns);
+    printf("Retunes=%lu\r\n", g_telemetry.retunes);
+    printf("Stops=%lu last=%luus max=%luus\r\n",
+           g_telemetry.stops, g_telemetry.lastStopCycles / cyclesPerUs, g_telemetry.maxStopCycles / cyclesPerUs);
+    printf("Starts=%lu last=%luus max=%luus\r\n",
+           g_telemetry.starts, g_telemetry.lastStartCycles / cyclesPerUs, g_telemetry.maxStartCycles / cyclesPerUs);
+    printf("UART overruns=%lu dropped commands=%lu\r\n", g_telemetry.uartOverruns, g_telemetry.droppedCommands);
+}
+
+static void prioritizeTriggers(void)
+{
+    // All interrupts default to the highest priority, so drop the DMA, sequencer and UART interrupts below the trigger
+    // sources. A trigger then pre-empts them instead of waiting for them to finish. InterruptIn pins share EINT3 and
+    // the mbed us ticker behind Timeout runs on TIMER3.
+    NVIC_SetPriority(DMA_IRQn, 1);
+    NVIC_SetPriority(TIMER2_IRQn, 1);
+    NVIC_SetPriority(UART0_IRQn, 1);
+    NVIC_SetPriority(EINT3_IRQn, 0);
+    NVIC_SetPriority(TIMER3_IRQn, 0);
 }